@@ -0,0 +1,92 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <SDL2/SDL.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <CHIP-8/ring.h>
+
+// Sound timer beeper. The CPU only posts level changes, stamped with the
+// sample they happen at, to a lock-free queue. Samples are made on another
+// thread: the SDL audio callback, or a WAV writer when headless. Until one
+// of them is started, beeps are dropped.
+//
+// The beeper plays a fixed square tone until it gets an XO-CHIP voice: a
+// 128-bit pattern, looped one bit at a time at 4000 * 2^((pitch-64)/48)
+// bits per second. Voices travel through the same queue as levels.
+//
+// With sync(), the device also becomes the emulation clock: pace() blocks
+// the CPU while it is more than `latency` samples ahead of what has been
+// played, and the callback stretches or squeezes its consumption by up to
+// `max_skew` to keep that lead steady (dynamic rate control).
+
+class Audio
+{
+
+public:
+    static const unsigned sample_rate = 44100;
+    static const unsigned tone        = 441; // Hz, a whole number of samples
+    static const unsigned latency     = 512; // Samples, two device buffers
+    static constexpr double max_skew  = 0.005;
+
+     Audio ();
+    ~Audio ();
+
+    void start_device ();
+    void start_wav    (std::string path);
+    void beep         (bool on, uint64_t sample);
+    void voice        (const std::array<uint8_t,16>& pattern, uint8_t pitch,
+                       uint64_t sample);
+    bool sync         ();
+    void pace         (uint64_t sample);
+
+private:
+    struct Event {
+        uint64_t sample;
+        bool     on;
+        bool     voice = false; // Sets pattern and pitch instead of the level
+        uint8_t  pitch = 0;
+        std::array <uint8_t,16> pattern {};
+    };
+
+    Ring <Event, 256>      events;
+    std::vector <int16_t>  square; // One period of the tone
+
+    // Owned by whichever thread makes the samples
+    bool     level    = false;
+    double   phase    = 0; // Into the square's period, or the pattern's bits
+    uint64_t position = 0; // Samples made so far
+    bool     patterned = false;
+    std::array <uint8_t,16> pattern {};
+    double   rate = 0; // Pattern bits per sample
+
+    // Audio clock, emulated samples on both sides
+    std::atomic <bool>     synced   {false};
+    std::atomic <uint64_t> produced {0}; // Reached by the CPU
+    std::atomic <uint64_t> played   {0}; // Consumed by the device
+    double clock   = 0;
+    Event  pending = {0, false};
+    bool   waiting = false; // Pending holds a future change
+
+    // Backends
+    SDL_AudioDeviceID  device = 0;
+    std::thread        writer;
+    std::atomic <bool> writing {false};
+    std::ofstream      file;
+
+    void        post     (const Event& event);
+    void        apply    (const Event& event);
+    int16_t     next     (double step);
+    void        fill     (int16_t* out, size_t count);
+    void        resample (int16_t* out, size_t count);
+    static void callback (void* data, Uint8* stream, int length);
+    void        write    ();
+};
+
+#endif // AUDIO_H
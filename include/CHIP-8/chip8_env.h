@@ -0,0 +1,56 @@
+#ifndef CHIP8_ENV_H
+#define CHIP8_ENV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* C interface to Env (env.h), for bindings. Buffers hold one slot per
+   instance: chip8_env_observation_size() bytes of observation, one float
+   of reward, one byte of done flag and one byte of action. Actions are 0
+   for no key or 1 + the key held. */
+
+#if defined(_WIN32) && defined(CHIP8_ENV_BUILD)
+#define CHIP8_ENV_API __declspec(dllexport)
+#elif defined(_WIN32)
+#define CHIP8_ENV_API __declspec(dllimport)
+#else
+#define CHIP8_ENV_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chip8_env chip8_env;
+
+enum {
+    CHIP8_ENV_INDICES = 0, /* One byte per pixel, its plane bits */
+    CHIP8_ENV_BITS    = 1  /* One bit per pixel per plane */
+};
+
+/* quirks is "modern", "vip", "schip" or "xochip". Returns NULL on failure. */
+CHIP8_ENV_API chip8_env* chip8_env_create (const char* rom, const char* quirks,
+                                           unsigned instances,
+                                           unsigned frame_skip,
+                                           unsigned frame_stack,
+                                           int observation,
+                                           unsigned threads);
+
+/* Watches a big-endian value of 1 to 4 bytes; takes effect on reset */
+CHIP8_ENV_API void   chip8_env_add_reward       (chip8_env* env, uint16_t addr,
+                                                 uint8_t bytes, float scale);
+CHIP8_ENV_API size_t chip8_env_observation_size (chip8_env* env);
+CHIP8_ENV_API void   chip8_env_reset            (chip8_env* env, uint64_t seed,
+                                                 uint8_t* observations);
+CHIP8_ENV_API void   chip8_env_step             (chip8_env* env,
+                                                 const uint8_t* actions,
+                                                 uint8_t* observations,
+                                                 float* rewards,
+                                                 uint8_t* dones);
+CHIP8_ENV_API void   chip8_env_destroy          (chip8_env* env);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHIP8_ENV_H */
@@ -0,0 +1,173 @@
+#ifndef CODE_H
+#define CODE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <CHIP-8/ir.h>
+#include <CHIP-8/memory.h>
+
+// Pre-decoded guest code. An opcode is matched against the instruction
+// patterns once, into the operation it selects and its operand fields.
+// Straight runs of decoded instructions are kept as blocks, by address,
+// and checked against memory whenever the page they sit on has changed,
+// so code that is rewritten is decoded again.
+//
+// Code runs in tiers. A block start is first interpreted, decoding every
+// instruction as it goes, and only counted; once entered Tiers::decode
+// times its block is decoded (tier 1). A block run Tiers::thread times
+// also gets a handler per instruction from the CPU's table for its quirk
+// profile (tier 2), which the CPU calls directly instead of dispatching
+// on the operation. Where a run of operations matches one of the
+// profile's fusions, a single handler runs them all, and a longer straight
+// run of register operations is lifted to an optimized IR (see ir.h).
+//
+// Blocks made from a rom's own bytes can be written to a cache file, keyed
+// by the rom's content hash and the decoder version, that other processes
+// map read-only and take blocks from before decoding anything.
+
+enum class Op : uint8_t {
+    CLS, RET, SCD, SCU, SCR, SCL, EXIT, LOW, HIGH, SYS,       // 00__
+    JP, CALL,                                                 // 1nnn 2nnn
+    SE_XB, SNE_XB, SE_XY, SAVE_XY, LOAD_XY,                   // 3 4 5
+    LD_XB, ADD_XB,                                            // 6 7
+    LD_XY, OR, AND, XOR, ADD_XY, SUB, SHR, SUBN, SHL,         // 8xy_
+    SNE_XY, LD_I, JP_V, RND, DRW, SKP, SKNP,                  // 9 A B C D E
+    LONG, PLANE, AUDIO, LD_X_DT, LD_X_K, LD_DT_X, LD_ST_X,    // F___
+    ADD_I_X, FONT, HFONT, BCD, PITCH, SAVE, LOAD,
+    SAVE_FLAGS, LOAD_FLAGS,
+    NONE                                                      // No match
+};
+
+struct Instr {
+    Op       op;
+    uint8_t  x, y, n;
+    uint16_t addr;   // nnn
+    uint16_t opcode; // As it was in memory
+
+    uint8_t  byte () const { return uint8_t(opcode & 0xFF); }
+    unsigned size () const { return op == Op::LONG ? 4 : 2; }
+};
+
+Instr       decode     (uint16_t opcode);
+const char* pattern    (Op op); // "7xnn" and the like
+bool        ends_block (Op op);
+char        to_char    (const uint8_t& hex);
+
+// Operation pairs, counted as [first][second] when the second ran right
+// after the first fell through to it
+static const unsigned op_count = unsigned(Op::NONE) + 1;
+using OpPairs = std::array <std::array <uint64_t, op_count>, op_count>;
+
+// Runs instrs[0] and, for a superinstruction, each following one while
+// control falls through to it. Returns how many ran.
+class CPU;
+using Handler = unsigned (*) (CPU& cpu, const Instr* instrs);
+
+// Consecutive operations that one handler runs as a superinstruction
+struct Fusion {
+    Op       ops[3];
+    unsigned length;
+    Handler  handler;
+};
+
+// A quirk profile's handlers, as tier 2 code is threaded with
+struct Handlers {
+    const Handler* single;  // Indexed by operation
+    const Fusion*  fusions; // Longest first
+    size_t         fusion_count;
+    Ir::Options    ir;      // Quirks the lifted code follows
+};
+
+// How tier 2 code starts at one instruction
+struct Step {
+    Handler  single; // That instruction alone
+    Handler  fused;  // It and the next length-1 ones, if they fuse
+    unsigned length;
+    const Ir* ir = nullptr; // Or they run as IR instead
+};
+
+struct Block {
+    uint16_t       start;
+    uint16_t       count;
+    const Instr*   code;
+    const Step*    steps; // Tier 2 only, one per instruction
+};
+
+class CodeFile;
+
+class Code
+{
+
+public:
+    static const uint32_t version   = 1;  // Of Op and Instr, for cache files
+    static const unsigned max_block = 64; // Instructions
+
+    // Promotion thresholds, in entries of a block start
+    struct Tiers {
+        uint32_t decode = 2;     // Interpreted this often, then decoded
+        uint32_t thread = 16;    // Run decoded this often, then threaded
+        bool     timed  = false; // Measure the time spent in each tier
+    };
+
+    struct Stats {
+        uint64_t decoded        = 0;  // Blocks decoded here
+        uint64_t loaded         = 0;  // Blocks taken from the cache file
+        uint64_t invalidated    = 0;  // Blocks dropped after their code changed
+        uint64_t lifted         = 0;  // Instructions lifted to IR
+        uint64_t lowered        = 0;  // IR operations left of them
+        uint64_t blocks[3]      = {}; // Block starts that reached each tier
+        uint64_t executed[3]    = {}; // Instructions run in each tier
+        uint64_t nanoseconds[3] = {}; // Time spent in each tier, if timed
+    };
+
+     Code ();
+    ~Code ();
+
+    const Block* find      (const Memory& RAM, uint16_t pc, const Handlers* table);
+    void         account   (unsigned tier, uint64_t instructions, uint64_t nanoseconds);
+    void         set_tiers (Tiers tiers);
+    const Tiers& tiers     ();
+    void         use_cache (const std::string& dir, uint64_t rom);
+    void         save      ();
+    Stats        stats     ();
+    void         reset_stats ();
+
+private:
+    // Decoded blocks hold their instructions, cached ones point into the file
+    struct Entry {
+        Block                 block;
+        std::vector <Instr>   decoded;
+        uint32_t              runs  = 0;
+        const Handlers*       table = nullptr; // The steps come from
+        std::vector <Step>    steps;
+        std::vector <std::unique_ptr<Ir>> lifted;
+    };
+
+    struct Page {
+        uint64_t digest = 0; // Of the memory page the blocks were checked on
+        std::array <Entry*, Memory::page_size>   starts {};
+        std::array <uint32_t, Memory::page_size> heat {}; // Interpreted entries
+        std::vector <std::unique_ptr<Entry>>     entries;
+    };
+
+    std::array <std::unique_ptr<Page>, Memory::pages> pages;
+    Tiers           thresholds;
+    Stats           counters;
+    std::string     cache_dir;
+    uint64_t        rom = 0;
+    const CodeFile* file = nullptr;
+    bool            file_opened = false;
+
+    void   verify    (Page& page, const Memory& RAM);
+    Entry* cached    (Page& page, const Memory& RAM, uint16_t pc);
+    Entry* translate (Page& page, const Memory& RAM, uint16_t pc);
+    Entry* add       (Page& page, std::unique_ptr<Entry> entry);
+    void   thread    (Entry& entry, const Handlers* table);
+};
+
+#endif // CODE_H
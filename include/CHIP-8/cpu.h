@@ -2,10 +2,18 @@
 #define CPU_H
 
 #include <array>
+#include <bitset>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include <CHIP-8/audio.h>
+#include <CHIP-8/code.h>
+#include <CHIP-8/hle.h>
 #include <CHIP-8/io.h>
+#include <CHIP-8/memory.h>
+#include <CHIP-8/pool.h>
+#include <CHIP-8/quirks.h>
 #include <CHIP-8/timer.h>
 
 class CPU
@@ -13,9 +21,79 @@ class CPU
 
 public:
 
-    CPU();
+    enum class Mode {
+        interactive, // SDL window, real-time pacing
+        batch        // Headless, virtual time
+    };
+
+    enum class Status {
+        running,
+        crashed, // PC left program memory
+        hung,    // Machine state stopped changing
+        exited   // SUPER-CHIP 00FD
+    };
+
+    // How tier 2 blocks reach each instruction's handler
+    enum class Dispatch {
+        calls, // Through the handler table, one indirect call each
+        labels // Labels as values, each handler jumping to the next
+               // (only with CHIP8_COMPUTED_GOTO, otherwise calls)
+    };
+
+    // Everything a program can observe plus the emulation clock, so that
+    // loading it resumes exactly where save() left off
+    struct State {
+        uint8_t  DT, ST, PITCH;
+        uint16_t SP, I, PC;
+        uint32_t RNG;
+        std::array <uint8_t,16>      V, RPL, PATTERN;
+        Memory   RAM;
+        Display  display;
+        uint64_t cycles, ticks;
+        Status   status;
+        uint64_t watchdog_hash;
+        bool     sound;
+    };
+
+    // A forked instance. Dropping it hands the CPU back to an arena
+    // that later forks reuse, so branching never reaches malloc once warm.
+    struct Recycle {
+        void operator() (CPU* cpu) const;
+    };
+    using Branch = std::unique_ptr <CPU, Recycle>;
+
+    // One bit per address, set for every instruction executed there
+    using Coverage = std::bitset <0x10000>;
+
+    CPU(Mode mode = Mode::interactive);
     void open_rom(std::string path);
+    void set_quirks(Quirks::Profile profile);
+    void record_audio(std::string path);
+    void sync_to_audio();
+    void set_run_ahead(unsigned frames);
+    void set_speculative(bool enabled);
     [[noreturn]] void run();
+    uint64_t run(uint64_t cycles);
+    void     advance(uint64_t frames);
+    Status   status();
+    uint64_t hash();
+    void     save(State &state);
+    void     load(const State &state);
+    void     reset(const State &pristine, uint32_t seed);
+    Branch   fork();
+    void     set_key(uint8_t key);
+    void     set_coverage(Coverage* map);
+    void     set_pair_profile(OpPairs* pairs);
+    void     seed(uint32_t value);
+    uint8_t  peek(uint16_t addr);
+    Display& display();
+    void     set_tiers(Code::Tiers tiers);
+    void     set_dispatch(Dispatch dispatch);
+    void     set_code_cache(std::string dir);
+    void     save_code();
+    Code::Stats code_stats();
+    void     set_hle(Hle::Mode mode);
+    Hle::Stats hle_stats();
 
 private:
 
@@ -28,12 +106,16 @@ private:
 
     using u8 = uint8_t;
     using u16 = uint16_t;
-    using Sprite = IO::Sprite;
+    using u32 = uint32_t;
+    using u64 = uint64_t;
     using micro = std::chrono::microseconds;
 
     /* Constants */
     const u8 width = 64;
     const u8 height = 32;
+    const u64 clock_rate = 500; // Instructions per second
+    const u64 timer_rate = 60;  // Timer ticks per second
+    const u64 watchdog_period = 720720; // Multiple of every loop length up to 16
 
     /* Hardware components */
     u8  DT; // Delay timer
@@ -41,22 +123,88 @@ private:
     u16 SP; // Stack pointer
     u16 I;  // Address register
     u16 PC; // Program counter
-    arr <u8,16>   V;   // Data register
-    arr <u8,4096> RAM; // Random-access memory
+    u8  PITCH; // XO-CHIP audio pitch
+    u32 RNG; // Random number generator state
+    arr <u8,16>      V;       // Data register
+    arr <u8,16>      RPL;     // SUPER-CHIP user flags (16 on XO-CHIP)
+    arr <u8,16>      PATTERN; // XO-CHIP audio pattern buffer
+    Memory           RAM;     // Random-access memory (all of it XO-CHIP only)
 
     /* Emulation */
+    Mode mode;
+    Quirks::Profile quirks = Quirks::Profile::modern;
+    bool quirks_set  = false; // By set_quirks, over the rom's own profile
+    u16  program_end = 0xEA0; // Stack and screen buffer start here
+    u64  cycles = 0; // Executed instructions
+    u64  ticks  = 0; // Elapsed timer ticks
+    Status current_status = Status::running;
+    u64    watchdog_hash  = 0;
+    bool   sound = false; // ST was nonzero at the last check
+    bool   idle_skip = true; // Idle loops may be fast-forwarded
+    bool   audio_clock = false; // Interactive pacing follows the audio device
+    unsigned ahead_frames = 0;  // Run-ahead depth, 0 when off
+    bool     speculating  = false; // Inside a run-ahead, nothing leaves the CPU
+    std::unique_ptr <State> timeline; // Real state while running ahead
+    Coverage* coverage = nullptr; // Filled by whole-frame runs when set
+    OpPairs*  pairs    = nullptr; // Filled by headless runs when set
+    Code     code;            // Decoded blocks, used by the headless loops
+    uint64_t rom_hash = 0;    // Of the open rom, keys the code cache
+    size_t   rom_size = 0;    // Of the open rom, in bytes
+    std::string code_dir;     // Code cache directory, empty when off
+    Dispatch dispatch = Dispatch::labels;
+    Hle      hle;             // Known subroutines, run natively when on
+
+    /* Speculation, one future per next key state (none first) */
+    std::unique_ptr <Pool>          pool;
+    vec <std::unique_ptr<CPU>>      futures;
+    vec <std::future<void>>         pending;
     Timer<micro> cpu_timer;
     Timer<micro> delay_timer;
     IO io;
+    Audio audio;
 
     /* Helpers */
-    void init_fonts  ();
-    bool matches     (u16 opcode, const char* pattern);
-    u8&  screen_byte (u8 x, u8 y);
+    void init_fonts       ();
+    void init_hires_fonts ();
+    void use_quirks       (Quirks::Profile profile);
+    static u16 program_end_of (Quirks::Profile profile);
 
     /* Control unit */
     u16  fetch   ();
-    void execute (u16 opcode);
+    u16  fetch   (u16 addr);
+    template <typename Q> void execute (u16 opcode);
+    template <typename Q> void execute (const Instr& instr);
+    template <typename Q, Op op> void perform (const Instr& instr);
+    template <typename Q, Op op, Op... rest>
+    static unsigned step (CPU& cpu, const Instr* instr);
+    template <typename Q> static const Handlers* handlers ();
+    template <typename Q, typename Each> void run_block (Each each);
+    unsigned together (const Instr* instr, unsigned length, u64 budget);
+    unsigned run_ir   (const Ir& ir, unsigned length);
+#ifdef CHIP8_COMPUTED_GOTO
+    template <typename Q, typename Each>
+    void run_labels (const Block& block, Each& each, u64& count);
+#endif
+
+    /* Run loops, one instance per quirk profile */
+    template <typename Q> [[noreturn]] void run_with ();
+    template <typename Q> uint64_t run_with (uint64_t cycles);
+    template <typename Q> void run_ahead ();
+    template <typename Q> void run_frames (uint64_t frames);
+    template <typename Q> [[noreturn]] void run_speculative ();
+    template <typename Q> void speculate ();
+
+    /* Idle loop detection */
+    u64  idle_loop          (u8 dt, bool* reads_dt = nullptr);
+    u64  skip_idle_loop     (u64 budget);
+    u64  skip_counting_loop (u64 budget);
+    void sleep_idle_loop    ();
+    void pass_time          (u64 end);
+
+    /* High-level emulation of known subroutines */
+    template <typename Q> u64  call_routine   (u64 budget);
+    template <typename Q> u64  routine_length (const Match& match);
+    template <typename Q> void run_routine    (const Match& match, u64 length);
 
     /* Stack operations */
     u16  stack_top  ();
@@ -65,45 +213,83 @@ private:
 
     /* Timer operations */
     void update_timers ();
+    void tick_timers   ();
+    void post_sound    (bool on, u64 cycle);
+    void post_voice    (u64 cycle);
+
+    /* Watchdog */
+    void watchdog ();
+
+    /* Lazy VF */
+    enum class Flag : u8 { none, carry, no_borrow, msb, lsb };
+    Flag flag_op = Flag::none; // Last flag-producing operation
+    u8   flag_a  = 0;          // and its operands
+    u8   flag_b  = 0;
+    void defer_flag   (Flag op, u8 a, u8 b, const u8 &target);
+    void resolve_flag ();
+    void clear_flag   ();
 
     /* Assembler subroutines */
     void ADD  (u16 &a, u16 b);
     void ADD  (u8 &a, u8 b);
+    template <bool reset_vf>
     void AND  (u8 &a, u8 b);
     void CALL (u16 addr);
+    template <typename Q>
     void CLS  ();
+    template <typename Q>
     void DRW  (u8 x, u8 y, u8 nibble);
+    void EXIT ();
+    void HIGH ();
     void JP   (u16 addr);
     void JP   (u8 offset, u16 addr);
-    void LD   (vec<u8*> range, u16 addr);
+    template <bool advance>
+    void LD   (vec<u8*> range, u16 &addr);
     void LD   (vec<u8> range, u16 addr);
-    void LD   (u16 addr, vec<u8*> range);
+    template <bool advance>
+    void LD   (u16 &addr, vec<u8*> range);
     void LD   (u16 addr, vec<u8> range);
     void LD   (u16 &a, u16 b);
     void LD   (u8 &a, u8 b);
+    void LD   (arr<u8,16> &flags, vec<u8*> range);
+    void LD   (vec<u8*> range, const arr<u8,16> &flags);
+    void LD   (arr<u8,16> &pattern, u16 addr);
+    void LONG (u16 &a);
+    void LOW  ();
+    template <bool reset_vf>
     void OR   (u8 &a, u8 b);
+    void PLANE(u8 mask);
     void RET  ();
     void RND  (u8 &a, u8 b);
+    void SCD  (u8 n);
+    void SCL  ();
+    void SCR  ();
+    void SCU  (u8 n);
+    template <bool wide>
     void SE   (u8 a, u8 b);
-    void SHL  (u8 &val);
-    void SHR  (u8 &val);
+    void SHL  (u8 &a, const u8 &b);
+    void SHR  (u8 &a, const u8 &b);
+    template <bool wide>
+    void SKIP ();
+    template <bool wide>
     void SKP  (u8 key);
+    template <bool wide>
     void SKNP (u8 key);
+    template <bool wide>
     void SNE  (u8 a, u8 b);
     void SUB  (u8 &a, u8 b);
     void SUBN (u8 &a, u8 b);
     void SYS  (u16 addr);
+    template <bool reset_vf>
     void XOR  (u8 &a, u8 b);
 
     /* Helper pseudo-subroutines */
     vec<u8>  BCD  (u8 bin);
     u16      FONT (u8 digit);
+    u16      HFONT(u8 digit);
     u8       KEY  ();
-    vec<u8*> RNGV (u8 lower_bound, u8 upper_bound);
+    vec<u8*> RNGV (u8 first, u8 last);
 
 };
 
-char       to_char   (const uint8_t& hex);
-IO::Sprite to_sprite (const uint8_t& byte);
-
 #endif // CPU_H
@@ -0,0 +1,68 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <array>
+#include <cstdint>
+
+// Framebuffer kept as two bitplanes of one packed 128-bit row per line,
+// which fits SUPER-CHIP's 128x64 mode. In 64x32 mode only the left half
+// of the first 32 rows is used. Scrolling shifts words and moves whole
+// rows, sprites are XORed as 128-bit masks. Drawing, scrolling and
+// clearing only touch the selected planes (XO-CHIP Fn01); anything else
+// only ever selects the first one.
+
+class Display
+{
+
+public:
+    static const unsigned max_width  = 128;
+    static const unsigned max_height = 64;
+    static const unsigned planes     = 2;
+
+    using Palette = std::array <uint32_t, 4>; // Indexed by plane bits
+
+    Display();
+
+    void     clear     ();
+    void     set_hires (bool enabled);
+    bool     hires     ();
+    unsigned width     ();
+    unsigned height    ();
+    void     select    (uint8_t mask);
+    uint8_t  selected  ();
+
+    template <bool clip>
+    bool draw   (const uint8_t* sprite, unsigned rows, unsigned x, unsigned y);
+    template <bool clip>
+    bool draw16 (const uint8_t* sprite, unsigned x, unsigned y);
+
+    void scroll_up    (unsigned rows);
+    void scroll_down  (unsigned rows);
+    void scroll_left  (unsigned cols);
+    void scroll_right (unsigned cols);
+
+    void     to_rgba    (uint32_t* out, const Palette& palette);
+    void     to_indices (uint8_t* out);
+    void     to_bits    (uint8_t* out);
+    uint64_t hash       (uint64_t seed);
+
+private:
+    // Pixel 0 is bit 63 of left, pixel 64 is bit 63 of right
+    struct alignas(16) Row {
+        uint64_t left, right;
+    };
+
+    using Plane = std::array <Row, max_height>;
+
+    std::array <Plane, planes> bitplanes;
+    uint8_t plane_mask = 0x01;
+    bool    hires_mode = false;
+
+    template <bool clip>
+    Row  place (uint32_t bits, unsigned bits_width, unsigned x);
+    template <bool clip, unsigned sprite_width>
+    bool blit  (Plane& rows, const uint8_t* sprite, unsigned count,
+                unsigned x, unsigned y);
+};
+
+#endif // DISPLAY_H
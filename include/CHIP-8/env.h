@@ -0,0 +1,86 @@
+#ifndef ENV_H
+#define ENV_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <CHIP-8/cpu.h>
+#include <CHIP-8/pool.h>
+#include <CHIP-8/quirks.h>
+
+// Batch of headless instances of one rom, stepped in lockstep for
+// reinforcement learning. Observations, rewards and done flags are written
+// into buffers the caller owns, one slot per instance back to back.
+// Stepping allocates nothing, threaded or not.
+//
+// An action is 0 for no key or 1 + the key held. It is held for
+// frame_skip frames, and the reward is the change over them of the values
+// watched in RAM. An observation is the last frame_stack frames, oldest
+// first, each either one byte per pixel (its plane bits) or one bit per
+// pixel per plane, always at 128x64. An instance is done once it crashes,
+// exits (00FD) or hangs, and restarts on its next step.
+
+class Env
+{
+
+public:
+    enum class Observation {
+        indices, // Display::to_indices
+        bits     // Display::to_bits
+    };
+
+    // Big-endian value of `bytes` bytes at addr, weighted by scale
+    struct Reward {
+        uint16_t addr;
+        uint8_t  bytes;
+        float    scale;
+    };
+
+    struct Config {
+        std::string     rom;
+        Quirks::Profile quirks      = Quirks::Profile::modern;
+        unsigned        instances   = 1;
+        unsigned        frame_skip  = 4;
+        unsigned        frame_stack = 1;
+        unsigned        threads     = 1;
+        Observation     observation = Observation::indices;
+        std::vector <Reward> rewards;
+    };
+
+    static const unsigned actions = 17;
+
+    Env (const Config& config);
+
+    void   watch            (Reward reward); // From the next reset on
+    size_t frame_size       ();
+    size_t observation_size ();
+    void   reset (uint64_t seed, uint8_t* observations);
+    void   step  (const uint8_t* actions, uint8_t* observations,
+                  float* rewards, uint8_t* dones);
+
+private:
+    Config     config;
+    CPU        root;
+    CPU::State boot; // Right after loading, where episodes start
+
+    std::vector <CPU::Branch> instances;
+    std::vector <uint8_t>     history;   // frame_stack frames per instance
+    std::vector <unsigned>    newest;    // Latest frame in history
+    std::vector <uint32_t>    watched;   // Last value of every Reward
+    std::vector <uint64_t>    episodes;
+    std::vector <uint8_t>     finished;
+    std::unique_ptr <Pool>    pool;
+    uint64_t seed = 0;
+
+    void     restart (size_t i, uint8_t* observation);
+    void     advance (size_t i, uint8_t action, uint8_t* observation,
+                      float* reward, uint8_t* done);
+    void     observe (size_t i, uint8_t* observation, bool first);
+    uint32_t value   (size_t i, const Reward& reward);
+    template <typename F> void each (F job);
+};
+
+#endif // ENV_H
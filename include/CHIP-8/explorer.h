@@ -0,0 +1,37 @@
+#ifndef EXPLORER_H
+#define EXPLORER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <CHIP-8/cpu.h>
+
+// Breadth-first search over keypad input, one frame per level. Every
+// state is expanded with each key held (and with none) for one frame; the
+// results are hashed and only states never seen before make it to the
+// next level. Levels are split across a thread pool, and deduplication
+// goes through a lock-free hash set shared by all of them.
+
+class Explorer
+{
+
+public:
+    struct Report {
+        uint64_t levels   = 0; // Frames deep the search got
+        uint64_t states   = 0; // Distinct machine states, the root included
+        uint64_t expanded = 0; // Frames run, duplicates included
+        uint64_t terminal = 0; // Distinct states that crashed, exited or hung
+        double   seconds  = 0;
+        CPU::Coverage pcs;     // Addresses executed on any branch
+    };
+
+    Explorer (unsigned threads);
+
+    // root must sit on a frame boundary, as it does right after loading
+    Report explore (CPU& root, uint64_t depth, size_t max_states);
+
+private:
+    unsigned threads;
+};
+
+#endif // EXPLORER_H
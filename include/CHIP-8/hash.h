@@ -0,0 +1,41 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Fast non-cryptographic 64-bit hash, 8 bytes per step with a
+// murmur-style finalizer. Chain calls through the seed to hash several
+// buffers as one.
+
+inline uint64_t hash64 (const void* data, size_t size, uint64_t seed = 0)
+{
+    const uint64_t k1 = 0x9E3779B97F4A7C15ull;
+    const uint64_t k2 = 0xC2B2AE3D27D4EB4Full;
+
+    auto bytes = static_cast<const uint8_t*>(data);
+    uint64_t h = seed ^ (size * k1);
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        h ^= word * k2;
+        h = ((h << 31) | (h >> 33)) * k1;
+    }
+
+    uint64_t tail = 0;
+    for (size_t shift = 0; i < size; ++i, shift += 8)
+        tail |= uint64_t(bytes[i]) << shift;
+    h ^= tail * k2;
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+#endif // HASH_H
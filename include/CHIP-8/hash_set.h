@@ -0,0 +1,68 @@
+#ifndef HASH_SET_H
+#define HASH_SET_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Fixed-capacity set of 64-bit hashes that any number of threads can
+// insert into without locking. Open addressing with linear probing: a slot
+// is claimed with a single compare-and-swap. 0 marks an empty slot, so a
+// zero hash is stored as 1.
+
+class HashSet
+{
+
+public:
+    HashSet (size_t capacity)
+    {
+        // Rounded up to a power of two
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+
+        mask = size - 1;
+        slots.reset(new std::atomic <uint64_t> [size]);
+        for (size_t i=0; i<size; ++i)
+            slots[i].store(0, std::memory_order_relaxed);
+    }
+
+    bool insert (uint64_t hash)
+    {
+        // True if the hash was not there yet. A full table reports every
+        // new hash as already present.
+        if (hash == 0)
+            hash = 1;
+
+        size_t index = hash & mask;
+        for (size_t probes=0; probes<=mask; ++probes) {
+            uint64_t found = slots[index].load(std::memory_order_relaxed);
+            if (found == hash)
+                return false;
+            if (found == 0) {
+                if (slots[index].compare_exchange_strong(found, hash,
+                                                         std::memory_order_relaxed)) {
+                    count.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+                if (found == hash)
+                    return false;
+            }
+            index = (index + 1) & mask;
+        }
+        return false;
+    }
+
+    size_t size ()
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::unique_ptr <std::atomic <uint64_t> []> slots;
+    size_t mask;
+    std::atomic <size_t> count {0};
+};
+
+#endif // HASH_SET_H
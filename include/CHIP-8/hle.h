@@ -0,0 +1,79 @@
+#ifndef HLE_H
+#define HLE_H
+
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+
+#include <CHIP-8/memory.h>
+
+// Common subroutines recognized at CALL targets, so that the CPU can run
+// them natively (high-level emulation). A routine is matched against
+// signatures written like the decoder's patterns: uppercase hex digits
+// must be there as they are, and a run of one lowercase letter is a field
+// that must hold the same value everywhere it appears (1ttt is the jump
+// back to the routine's own start). The fields are the parameters of the
+// CPU's native version, which leaves the machine as the instructions
+// would have, including the time they take.
+//
+// Matches are kept by target address along with the code they were
+// matched on, which is compared again on every call.
+
+enum class Routine : uint8_t {
+    score, // Fs33 F265, then each digit drawn with F_29 Dabn, 7akk between
+    fill,  // A loop storing V0..VX at I, stepping I and counting in VC
+    copy,  // A loop loading V0..VX from I and storing them VA further on
+    none
+};
+
+struct Match {
+    Routine  routine = Routine::none;
+    uint16_t start   = 0; // Of the routine
+    uint16_t length  = 0; // In bytes, up to and including its 00EE
+    std::array <uint16_t, 26> fields {}; // By letter
+
+    uint16_t field (char name) const { return fields[size_t(name - 'a')]; }
+};
+
+class Hle
+{
+
+public:
+    enum class Mode {
+        off,
+        on,     // Known routines run natively
+        verify  // Also run as instructions on a fork, and compared
+    };
+
+    struct Stats {
+        uint64_t calls        = 0; // Calls looked at
+        uint64_t replaced     = 0; // Run natively
+        uint64_t instructions = 0; // That those stood for
+        uint64_t mismatched   = 0; // Verified and found different
+    };
+
+    static const unsigned max_length = 12; // Instructions in a signature
+
+    const Match* find    (const Memory& RAM, uint16_t target, uint16_t program_end);
+    void         account (uint64_t instructions, bool mismatched);
+    void         set_mode (Mode mode);
+    void         reset   ();
+    Mode         mode    () const;
+    Stats        stats   () const;
+
+private:
+    struct Entry {
+        std::array <uint8_t, 2 * max_length> code; // As it was matched
+        Match match;
+    };
+
+    std::unordered_map <uint16_t, Entry> entries;
+    Mode  current = Mode::off;
+    Stats counters;
+
+    static bool matches (const Memory& RAM, uint16_t target, const char* const* signature,
+                         Match& match);
+    static bool valid   (const Match& match);
+};
+
+#endif // HLE_H
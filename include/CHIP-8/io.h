@@ -6,6 +6,8 @@
 #include <string>
 #include <vector>
 
+#include <CHIP-8/display.h>
+
 class IO
 {
 
@@ -15,20 +17,22 @@ public:
         Scale (float value);
         Scale (float x_scale, float y_scale);
     };
-    using Coord  = unsigned int;
     using Pixels = unsigned int;
     using String = std::string;
-    using Sprite = std::array <uint32_t,8>;
 
      IO (String title, Pixels width, Pixels height, Scale scale);
+     IO (); // Headless
     ~IO ();
 
-    void    clear           ();
-    bool    draw            (const Sprite& sprite, Coord x, Coord y);
-    uint8_t last_key        ();
-    void    refresh_display ();
-    uint8_t wait_key        ();
-    void    update          ();
+    void     clear           ();
+    Display& display         ();
+    void     hold_display    (bool held);
+    uint8_t  last_key        ();
+    void     present         ();
+    void     refresh_display ();
+    void     set_key         (uint8_t key);
+    uint8_t  wait_key        ();
+    void     update          ();
 
 private:
     struct RGBA {
@@ -40,7 +44,14 @@ private:
     Pixels width;
     Pixels height;
     Scale  scale;
-    std::vector <uint32_t> pixels;
+    bool   headless = false;
+    bool   held     = false; // Only present() reaches the window
+    Display screen;
+    Display::Palette palette = {0x000000FF,  // Background
+                                0xFFFFFFFF,  // Plane 1
+                                0xAAAAAAFF,  // Plane 2
+                                0x555555FF}; // Both planes
+    std::vector <uint32_t> pixels; // Expanded screen, uploaded to texture
 
     // Keyboard
     uint8_t key_value = 0xFF;
@@ -0,0 +1,59 @@
+#ifndef IR_H
+#define IR_H
+
+#include <cstdint>
+#include <vector>
+
+struct Instr;
+
+// Straight runs of register instructions (6xnn, 7xnn, 8xy_, Annn, Fx1E)
+// lifted into a small register IR and optimized as a whole: constants
+// from loads are folded into later operations, results and VF flags that
+// are overwritten before anything reads them are dropped, and 7xnn adds
+// whose carries are dead are merged. What is left runs on a plain
+// interpreter over the register file.
+//
+// Inside a run the flags are computed eagerly, so running one leaves no
+// flag pending. Only loads (6Fnn, 8Fy0) are lifted with VF as their
+// target: the others would land their flag and result in one register.
+
+class Ir
+{
+
+public:
+    // The quirks the lifted semantics depend on
+    struct Options {
+        bool logic_vf = false; // 8xy1/8xy2/8xy3 clear VF
+        bool shift_vy = false; // 8xy6/8xyE shift VY into VX
+    };
+
+    static bool lifts (const Instr& instr);
+
+    void     lift (const Instr* instrs, unsigned count, Options options);
+    void     run  (uint8_t* V, uint16_t& I) const;
+    unsigned size () const; // Operations left after optimizing
+
+private:
+    enum class Kind : uint8_t {
+        set, move, add, sub, subn, or_, and_, xor_, shr, shl, set_i, add_i
+    };
+
+    struct Node {
+        Kind     kind;
+        uint8_t  dst;
+        uint8_t  src;      // Register, unless constant
+        bool     constant; // The source is imm
+        bool     flag;     // Writes VF
+        uint16_t imm;
+    };
+
+    std::vector <Node> code;
+
+    static uint8_t alu (Kind kind, uint8_t a, uint8_t b, uint8_t& flag);
+
+    void fold      ();
+    void eliminate ();
+    void combine   ();
+};
+
+#endif // IR_H
@@ -0,0 +1,33 @@
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only view of a whole file, mapped into memory. An empty, missing
+// or unreadable file gives an invalid mapping.
+
+class Mapping
+{
+
+public:
+     Mapping (const std::string& path);
+    ~Mapping ();
+    Mapping (const Mapping&) = delete;
+    Mapping& operator= (const Mapping&) = delete;
+
+    bool           valid ();
+    const uint8_t* data  ();
+    size_t         size  ();
+
+private:
+    const uint8_t* view   = nullptr;
+    size_t         length = 0;
+#ifdef _WIN32
+    void* file    = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+#endif // MAPPING_H
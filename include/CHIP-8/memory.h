@@ -0,0 +1,73 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// 64 KB guest address space made of reference-counted 256-byte pages.
+// Copying a Memory shares every page; a shared page is copied on its
+// first write. share() swaps private pages for identical ones already
+// known, so instances booted from the same ROM end up holding a single
+// copy of its bytes and of the fonts.
+
+class Memory
+{
+
+public:
+    static const unsigned size      = 0x10000;
+    static const unsigned page_size = 0x100;
+    static const unsigned pages     = size / page_size;
+
+     Memory ();
+     Memory (const Memory& other);
+    ~Memory ();
+    Memory& operator= (const Memory& other);
+
+    uint8_t  operator[] (uint16_t addr) const;
+    void     write      (uint16_t addr, uint8_t value);
+    void     load       (uint16_t addr, const uint8_t* data, size_t size);
+    void     share      ();
+    uint64_t hash       (uint64_t seed = 0) const;
+    uint64_t digest     (unsigned page) const;
+
+private:
+    struct Page {
+        std::atomic <uint32_t> refs;
+        std::atomic <uint64_t> digest; // Content hash, 0 until needed
+        uint8_t data[page_size];
+    };
+
+    std::array <Page*, pages> table;
+
+    static Page* allocate ();
+    static void  retain   (Page* page);
+    static void  release  (Page* page);
+    static Page* zero     ();
+};
+
+inline uint8_t Memory::operator[] (uint16_t addr) const
+{
+    return table[addr / page_size]->data[addr % page_size];
+}
+
+inline void Memory::write (uint16_t addr, uint8_t value)
+{
+    // Writing what is already there never copies a page
+    Page* &page = table[addr / page_size];
+    if (page->data[addr % page_size] == value)
+        return;
+
+    if (page->refs.load(std::memory_order_acquire) > 1) {
+        Page* copy = allocate();
+        for (unsigned i=0; i<page_size; ++i)
+            copy->data[i] = page->data[i];
+        release(page);
+        page = copy;
+    }
+    page->data[addr % page_size] = value;
+    page->digest.store(0, std::memory_order_relaxed);
+}
+
+#endif // MEMORY_H
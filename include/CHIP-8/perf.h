@@ -0,0 +1,30 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <cstdint>
+#include <memory>
+
+class Perf
+{
+
+public:
+    struct Counters {
+        uint64_t cycles        = 0;
+        uint64_t instructions  = 0;
+        uint64_t branch_misses = 0;
+        uint64_t l1d_misses    = 0;
+    };
+
+     Perf();
+    ~Perf();
+    bool     available();
+    void     start();
+    Counters stop();
+
+private:
+    struct Impl;
+    std::unique_ptr <Impl> pimpl; // Owns the counters' descriptors, so no copies
+
+};
+
+#endif // PERF_H
@@ -0,0 +1,42 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads taking jobs in submission order, or running
+// batches of numbered jobs that the caller waits on
+
+class Pool
+{
+
+public:
+     Pool (unsigned threads);
+    ~Pool ();
+
+    std::future<void> submit (std::function<void()> job);
+    void              run    (size_t count, const std::function<void(size_t)>& job);
+
+private:
+    std::vector <std::thread>                  workers;
+    std::queue  <std::packaged_task<void()>>   jobs;
+    std::mutex              jobs_mutex;
+    std::condition_variable jobs_ready;
+    bool stopping = false;
+
+    /* Batch being run, numbers handed out in order */
+    const std::function<void(size_t)>* batch = nullptr;
+    size_t batch_next = 0;
+    size_t batch_size = 0;
+    size_t batch_left = 0; // Not finished yet
+    std::condition_variable batch_done;
+
+    void work ();
+};
+
+#endif // POOL_H
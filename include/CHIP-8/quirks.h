@@ -0,0 +1,66 @@
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include <string>
+
+// Behaviours on which CHIP-8 interpreters disagree. Each profile is a
+// policy type the CPU core is instantiated with, so the choice is made
+// once at load time and never tested per instruction.
+
+namespace Quirks
+{
+
+enum class Profile { modern, vip, schip, xochip };
+
+inline Profile profile (const std::string& name)
+{
+    if (name == "vip")    return Profile::vip;
+    if (name == "schip")  return Profile::schip;
+    if (name == "xochip") return Profile::xochip;
+    return Profile::modern;
+}
+
+// This emulator's original behaviour
+struct Modern {
+    static constexpr bool shift_vy  = false; // 8xy6/8xyE shift VY into VX
+    static constexpr bool advance_i = false; // Fx55/Fx65 leave I at I+X+1
+    static constexpr bool jump_vx   = false; // Bxnn jumps to xnn + VX
+    static constexpr bool clip      = false; // Sprites clip at the edges
+    static constexpr bool logic_vf  = false; // 8xy1/8xy2/8xy3 reset VF
+    static constexpr bool superchip = false; // SUPER-CHIP opcodes and hires
+    static constexpr bool xochip    = false; // XO-CHIP opcodes, 64 KB and planes
+};
+
+struct VIP {
+    static constexpr bool shift_vy  = true;
+    static constexpr bool advance_i = true;
+    static constexpr bool jump_vx   = false;
+    static constexpr bool clip      = true;
+    static constexpr bool logic_vf  = true;
+    static constexpr bool superchip = false;
+    static constexpr bool xochip    = false;
+};
+
+struct SCHIP {
+    static constexpr bool shift_vy  = false;
+    static constexpr bool advance_i = false;
+    static constexpr bool jump_vx   = true;
+    static constexpr bool clip      = true;
+    static constexpr bool logic_vf  = false;
+    static constexpr bool superchip = true;
+    static constexpr bool xochip    = false;
+};
+
+struct XOCHIP {
+    static constexpr bool shift_vy  = true;
+    static constexpr bool advance_i = true;
+    static constexpr bool jump_vx   = false;
+    static constexpr bool clip      = false;
+    static constexpr bool logic_vf  = false;
+    static constexpr bool superchip = true;
+    static constexpr bool xochip    = true;
+};
+
+}
+
+#endif // QUIRKS_H
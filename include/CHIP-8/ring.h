@@ -0,0 +1,48 @@
+#ifndef RING_H
+#define RING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Fixed-size single-producer single-consumer queue. Each side owns one
+// index, so neither ever waits on the other: safe to use from an audio
+// callback. SIZE must be a power of two.
+
+template <typename T, size_t SIZE>
+class Ring
+{
+    static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two");
+
+public:
+    bool push (const T& item)
+    {
+        // Producer side, false if full
+        size_t head = write.load(std::memory_order_relaxed);
+        if (head - read.load(std::memory_order_acquire) == SIZE)
+            return false;
+
+        items[head & (SIZE - 1)] = item;
+        write.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop (T& item)
+    {
+        // Consumer side, false if empty
+        size_t tail = read.load(std::memory_order_relaxed);
+        if (tail == write.load(std::memory_order_acquire))
+            return false;
+
+        item = items[tail & (SIZE - 1)];
+        read.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array <T, SIZE> items;
+    alignas(64) std::atomic <size_t> write {0};
+    alignas(64) std::atomic <size_t> read  {0};
+};
+
+#endif // RING_H
@@ -0,0 +1,47 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <CHIP-8/quirks.h>
+
+// Rom images, mapped and read in one go, kept for the whole run by content
+// hash: opening the same bytes again, from any path, hands out the image
+// already held, and reopening an unchanged file does not touch it at all.
+// The hash also keys what is known about a rom, read from a text file
+// with one rom per line:
+//
+//     <hash, 16 hex digits> <modern|vip|schip|xochip> [noidle]
+//
+// noidle turns off idle-loop fast-forwarding for roms it misbehaves on.
+
+class Rom
+{
+
+public:
+    struct Info {
+        Quirks::Profile quirks    = Quirks::Profile::modern;
+        bool            idle_skip = true;
+    };
+
+    static const Rom& open          (const std::string& path);
+    static const Rom* find          (uint64_t hash); // nullptr if not open
+    static void       read_metadata (const std::string& path);
+    static void       describe      (uint64_t hash, const Info& info);
+
+    const uint8_t* data () const;
+    size_t         size () const;
+    uint64_t       hash () const;
+    const Info*    info () const; // nullptr for unknown roms
+
+private:
+    std::vector <uint8_t> bytes;
+    uint64_t digest;
+
+    Rom (std::vector <uint8_t> bytes, uint64_t digest);
+};
+
+#endif // ROM_H
@@ -0,0 +1,51 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Chrome trace-event recorder (chrome://tracing, ui.perfetto.dev).
+// While disabled, a zone costs a single test of Trace::enabled.
+// Zones may be opened from any thread; start, stop and toggle only from
+// the main one.
+
+class Trace
+{
+
+public:
+    class Zone {
+    public:
+        Zone (const char* name) : name(name), begin(-1) {
+            if (Trace::enabled)
+                begin = Trace::now();
+        }
+        ~Zone () {
+            if (begin >= 0)
+                Trace::complete(name, begin);
+        }
+    private:
+        const char* name;
+        long long   begin;
+    };
+
+    static std::atomic<bool> enabled;
+
+    static void start       (std::string path);
+    static void stop        ();
+    static void toggle      ();
+    static void frame       (uint64_t number);
+    static void thread_name (const char* name);
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    static std::string             path;
+    static std::atomic<long long> origin; // Of clock, at start, in nanoseconds
+
+    static long long now      ();
+    static void      complete (const char* name, long long begin);
+};
+
+#endif // TRACE_H
@@ -0,0 +1,264 @@
+#include <CHIP-8/audio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using namespace std;
+
+namespace {
+
+void put (ofstream &file, uint32_t value, unsigned bytes)
+{
+    // Little-endian field
+    for (unsigned i=0; i<bytes; ++i)
+        file.put(char(value >> 8*i));
+}
+
+void header (ofstream &file, uint32_t data_size)
+{
+    // 16-bit mono PCM
+    file.write("RIFF", 4);
+    put(file, 36 + data_size, 4);
+    file.write("WAVE", 4);
+    file.write("fmt ", 4);
+    put(file, 16, 4);
+    put(file, 1, 2);
+    put(file, 1, 2);
+    put(file, Audio::sample_rate, 4);
+    put(file, Audio::sample_rate * 2, 4);
+    put(file, 2, 2);
+    put(file, 16, 2);
+    file.write("data", 4);
+    put(file, data_size, 4);
+}
+
+}
+
+Audio::Audio ()
+{
+    // Square wave, precomputed so that making samples is a table read
+    square.resize(sample_rate / tone);
+    for (size_t i=0; i<square.size(); ++i)
+        square[i] = i < square.size() / 2 ? 4000 : -4000;
+}
+
+Audio::~Audio ()
+{
+    if (device != 0)
+        SDL_CloseAudioDevice(device);
+
+    if (writer.joinable()) {
+        writing = false;
+        writer.join();
+    }
+}
+
+void Audio::start_device ()
+{
+    // Interactive backend. A 256-sample buffer keeps the delay between a
+    // change and the speaker around 6 ms.
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0)
+        return;
+
+    SDL_AudioSpec want = {}, have;
+    want.freq     = int(sample_rate);
+    want.format   = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples  = 256;
+    want.callback = callback;
+    want.userdata = this;
+
+    // Having no sound card is not a reason to stop the emulator
+    device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+    if (device != 0)
+        SDL_PauseAudioDevice(device, 0);
+}
+
+void Audio::start_wav (string path)
+{
+    // Headless backend, samples are written on a background thread
+
+    file.open(path, ios::binary);
+    if (!file.is_open())
+        return;
+
+    header(file, 0);
+    writing = true;
+    writer = thread(&Audio::write, this);
+}
+
+void Audio::beep (bool on, uint64_t sample)
+{
+    // Sets the beeper level from the given sample on
+
+    Event event;
+    event.sample = sample;
+    event.on = on;
+    post(event);
+}
+
+void Audio::voice (const array<uint8_t,16>& pattern, uint8_t pitch, uint64_t sample)
+{
+    // Plays the XO-CHIP pattern at the given pitch from the given sample on
+
+    Event event;
+    event.sample = sample;
+    event.on = false;
+    event.voice = true;
+    event.pitch = pitch;
+    event.pattern = pattern;
+    post(event);
+}
+
+void Audio::post (const Event& event)
+{
+    if (device != 0)
+        events.push(event); // Dropped if the device stalls
+    else if (writing)
+        while (!events.push(event))
+            this_thread::yield();
+}
+
+void Audio::apply (const Event& event)
+{
+    // On the thread making the samples
+
+    if (!event.voice) {
+        level = event.on;
+        return;
+    }
+
+    if (!patterned)
+        phase = 0;
+    patterned = true;
+    pattern = event.pattern;
+    rate = 4000.0 * pow(2.0, (event.pitch - 64) / 48.0) / sample_rate;
+}
+
+bool Audio::sync ()
+{
+    // Makes the device the emulation clock, false if there is no device
+
+    if (device == 0)
+        return false;
+
+    synced = true;
+    return true;
+}
+
+void Audio::pace (uint64_t sample)
+{
+    // Blocks while the emulation is too far ahead of the device
+
+    produced.store(sample, memory_order_relaxed);
+    while (sample > played.load(memory_order_acquire) + latency)
+        SDL_Delay(1);
+}
+
+int16_t Audio::next (double step)
+{
+    // The current sample, then moves on by step emulated samples
+
+    if (!patterned) {
+        int16_t sample = level ? square[size_t(phase)] : 0;
+        phase += step;
+        if (phase >= square.size())
+            phase -= square.size();
+        return sample;
+    }
+
+    unsigned bit = unsigned(phase);
+    bool high = pattern[bit / 8] >> (7 - bit % 8) & 1;
+    phase += step * rate;
+    if (phase >= 128)
+        phase -= 128;
+    return level ? (high ? 4000 : -4000) : 0;
+}
+
+void Audio::fill (int16_t* out, size_t count)
+{
+    for (size_t i=0; i<count; ++i)
+        out[i] = next(1);
+    position += count;
+}
+
+void Audio::resample (int16_t* out, size_t count)
+{
+    // Plays the emulated timeline at `ratio` emulated samples per device
+    // sample. A lead over `latency` speeds it up, a shorter one slows it
+    // down. The clock never passes the CPU, so if the emulation stalls the
+    // device holds the current level instead of underrunning.
+
+    double limit = double(produced.load(memory_order_relaxed));
+    double lead  = limit - clock;
+    double ratio = 1.0 + max_skew * (lead - latency) / latency;
+    ratio = min(max(ratio, 1.0 - max_skew), 1.0 + max_skew);
+
+    for (size_t i=0; i<count; ++i) {
+        while (waiting || events.pop(pending)) {
+            waiting = double(pending.sample) > clock;
+            if (waiting)
+                break;
+            apply(pending);
+        }
+
+        out[i] = next(ratio);
+        clock = min(clock + ratio, limit);
+    }
+    position += count;
+    played.store(uint64_t(clock), memory_order_release);
+}
+
+void Audio::callback (void* data, Uint8* stream, int length)
+{
+    // Unsynced, changes take effect at the start of the next buffer
+
+    auto audio = static_cast<Audio*>(data);
+    auto out   = reinterpret_cast<int16_t*>(stream);
+    auto count = size_t(length) / sizeof(int16_t);
+
+    if (audio->synced) {
+        audio->resample(out, count);
+        return;
+    }
+
+    Event event;
+    while (audio->events.pop(event))
+        audio->apply(event);
+    audio->fill(out, count);
+}
+
+void Audio::write ()
+{
+    // Renders every change at its own sample, so the file follows the
+    // emulated clock however fast the run goes
+
+    vector<int16_t> buffer(4096);
+    Event event;
+
+    while (true) {
+        if (!events.pop(event)) {
+            if (writing) {
+                this_thread::sleep_for(chrono::milliseconds(1));
+                continue;
+            }
+            // Stopped, but the last changes may have come in meanwhile
+            if (!events.pop(event))
+                break;
+        }
+
+        while (position < event.sample) {
+            auto count = size_t(min<uint64_t>(buffer.size(), event.sample - position));
+            fill(buffer.data(), count);
+            file.write(reinterpret_cast<const char*>(buffer.data()),
+                       streamsize(count * sizeof(int16_t)));
+        }
+        apply(event);
+    }
+
+    file.seekp(0);
+    header(file, uint32_t(position * sizeof(int16_t)));
+    file.close();
+}
@@ -0,0 +1,301 @@
+#include <CHIP-8/cpu.h>
+#include <CHIP-8/perf.h>
+#include <CHIP-8/rom.h>
+#include <CHIP-8/timer.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Usage: CHIP-8-bench [--perf] [--wav] [--fork] [--reset] [--hash] [--cycles N]
+//                     [--quirks profile] [--db file] [--code-cache dir]
+//                     [--tiers decode,thread] [--dispatch] [--pairs]
+//                     [--hle] [--hle-verify] rom...
+//
+// Runs every rom headless for N guest instructions and reports host time
+// per guest instruction. With --perf, the measured region is also wrapped
+// in hardware counters (Linux only). With --wav, each rom's beeper is
+// recorded next to it as <rom>.wav. With --fork, the state reached is then
+// branched repeatedly, each branch with a different key held for one
+// frame, to report forks per second. With --reset, it is played a frame at
+// a time, each time going back to the state right after loading, to report
+// the time per reset. With --hash, each rom's content hash is shown, as
+// used to key --db files (see rom.h). With --code-cache, decoded blocks
+// are taken from and saved to cache files in dir (see code.h), and the
+// blocks decoded and taken from the file are shown. With --tiers, code is
+// promoted after the given number of entries (see code.h), and the blocks,
+// share of instructions and time per instruction in each tier are shown,
+// along with the instructions lifted to IR and the IR operations left of
+// them after optimizing. With --dispatch, each rom is run again from the
+// start once per tier 2 dispatch (handler calls, then labels as values if
+// built with CHIP8_COMPUTED_GOTO), reporting time per instruction for both
+// and whether they ended in the same state. With --pairs, the main runs
+// are interpreted while counting which operation follows which, and the
+// most frequent pairs over all roms are listed at the end: the candidates
+// for superinstructions (see CPU::handlers). With --hle, known subroutines
+// run natively (see hle.h), and the calls replaced and their share of the
+// instructions are shown. With --hle-verify, each replaced call also runs
+// as instructions on a fork, and the calls where the two differed are
+// shown as well.
+
+int main(int argc, char *argv[])
+{
+    uint64_t cycles = 10000000;
+    bool use_perf = false;
+    bool use_wav = false;
+    bool use_fork = false;
+    bool use_reset = false;
+    bool use_hash = false;
+    bool use_quirks = false;
+    string code_dir;
+    bool use_tiers = false;
+    bool use_dispatch = false;
+    bool use_pairs = false;
+    auto hle = Hle::Mode::off;
+    OpPairs pairs {};
+    Code::Tiers tiers;
+    auto quirks = Quirks::Profile::modern;
+    vector<string> roms;
+
+    for (int i=1; i<argc; ++i) {
+        if (!strcmp(argv[i], "--perf"))
+            use_perf = true;
+        else if (!strcmp(argv[i], "--wav"))
+            use_wav = true;
+        else if (!strcmp(argv[i], "--fork"))
+            use_fork = true;
+        else if (!strcmp(argv[i], "--reset"))
+            use_reset = true;
+        else if (!strcmp(argv[i], "--hash"))
+            use_hash = true;
+        else if (!strcmp(argv[i], "--cycles") && i+1 < argc)
+            cycles = strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--quirks") && i+1 < argc) {
+            quirks = Quirks::profile(argv[++i]);
+            use_quirks = true;
+        }
+        else if (!strcmp(argv[i], "--db") && i+1 < argc)
+            Rom::read_metadata(argv[++i]);
+        else if (!strcmp(argv[i], "--code-cache") && i+1 < argc)
+            code_dir = argv[++i];
+        else if (!strcmp(argv[i], "--dispatch"))
+            use_dispatch = true;
+        else if (!strcmp(argv[i], "--pairs"))
+            use_pairs = true;
+        else if (!strcmp(argv[i], "--hle"))
+            hle = Hle::Mode::on;
+        else if (!strcmp(argv[i], "--hle-verify"))
+            hle = Hle::Mode::verify;
+        else if (!strcmp(argv[i], "--tiers") && i+1 < argc) {
+            char* end;
+            tiers.decode = strtoul(argv[++i], &end, 10);
+            if (*end == ',')
+                tiers.thread = strtoul(end + 1, nullptr, 10);
+            tiers.timed = true;
+            use_tiers = true;
+        }
+        else
+            roms.push_back(argv[i]);
+    }
+
+    Perf perf;
+    if (use_perf && !perf.available()) {
+        printf("Contadores de hardware no disponibles.\n");
+        use_perf = false;
+    }
+#ifndef CHIP8_COMPUTED_GOTO
+    if (use_dispatch) {
+        printf("Despacho con etiquetas no disponible (CHIP8_COMPUTED_GOTO).\n");
+        use_dispatch = false;
+    }
+#endif
+
+    const char* status[] = {"running", "crashed", "hung", "exited"};
+
+    printf("%-24s %12s %8s %10s", "rom", "instr", "status", "ns/instr");
+    if (use_perf)
+        printf(" %12s %12s %12s %12s", "cyc/instr", "hostin/instr",
+                                       "brmiss/instr", "l1dmiss/instr");
+    if (use_fork)
+        printf(" %12s", "forks/s");
+    if (use_reset)
+        printf(" %10s", "ns/reset");
+    if (use_hash)
+        printf(" %16s", "hash");
+    if (!code_dir.empty())
+        printf(" %8s %8s", "decoded", "cached");
+    if (use_tiers)
+        printf(" %20s %14s %20s %12s", "blocks t0/t1/t2", "instr% t0/t1/t2",
+                                       "ns/instr t0/t1/t2", "ir in/out");
+    if (use_dispatch)
+        printf(" %10s %10s %5s", "ns calls", "ns labels", "same");
+    if (hle != Hle::Mode::off)
+        printf(" %10s %6s", "routines", "hle%");
+    if (hle == Hle::Mode::verify)
+        printf(" %10s", "mismatched");
+    printf("\n");
+
+    for (auto &path : roms)
+    {
+        CPU cpu(CPU::Mode::batch);
+        if (!code_dir.empty())
+            cpu.set_code_cache(code_dir);
+        if (use_tiers)
+            cpu.set_tiers(tiers);
+        if (use_pairs)
+            cpu.set_pair_profile(&pairs);
+        cpu.set_hle(hle);
+        if (use_quirks)
+            cpu.set_quirks(quirks);
+        try {
+            cpu.open_rom(path);
+        }
+        catch (const runtime_error& error) {
+            printf("%s\n", error.what());
+            continue;
+        }
+        if (use_wav)
+            cpu.record_audio(path + ".wav");
+
+        CPU::State boot;
+        if (use_reset)
+            cpu.save(boot);
+
+        Timer<chrono::nanoseconds> wall;
+        wall.start();
+        if (use_perf)
+            perf.start();
+
+        auto executed = cpu.run(cycles);
+
+        auto counters = use_perf ? perf.stop() : Perf::Counters();
+        wall.stop();
+
+        double n = executed ? double(executed) : 1.0;
+        printf("%-24s %12llu %8s %10.2f", path.c_str(),
+               (unsigned long long) executed, status[int(cpu.status())],
+               wall.getTime() / n);
+        if (use_perf)
+            printf(" %12.2f %12.2f %12.4f %12.4f",
+                   counters.cycles / n,
+                   counters.instructions / n,
+                   counters.branch_misses / n,
+                   counters.l1d_misses / n);
+        if (use_fork) {
+            const unsigned forks = 100000;
+            wall.start();
+            for (unsigned i=0; i<forks; ++i) {
+                auto branch = cpu.fork();
+                branch->set_key(i % 16);
+                branch->run(8); // About a frame
+            }
+            wall.stop();
+            printf(" %12.0f", forks / (wall.getTime() / 1e9));
+        }
+        if (use_reset) {
+            // Only the resets are timed, each after a frame of play
+            const unsigned resets = 100000;
+            chrono::steady_clock::duration spent(0);
+            for (unsigned i=0; i<resets; ++i) {
+                cpu.run(8);
+                auto begin = chrono::steady_clock::now();
+                cpu.reset(boot, i);
+                spent += chrono::steady_clock::now() - begin;
+            }
+            printf(" %10.1f", chrono::duration<double, nano>(spent).count() / resets);
+        }
+        if (use_hash)
+            printf(" %016llx", (unsigned long long) Rom::open(path).hash());
+        if (!code_dir.empty()) {
+            auto stats = cpu.code_stats();
+            printf(" %8llu %8llu", (unsigned long long) stats.decoded,
+                                   (unsigned long long) stats.loaded);
+            cpu.save_code();
+        }
+        if (use_tiers) {
+            // Counted over everything above, forks excepted
+            auto stats = cpu.code_stats();
+            uint64_t total = 0;
+            for (auto count : stats.executed)
+                total += count;
+
+            char blocks[64], share[64], time[64], ir[64];
+            snprintf(blocks, sizeof(blocks), "%llu/%llu/%llu",
+                     (unsigned long long) stats.blocks[0],
+                     (unsigned long long) stats.blocks[1],
+                     (unsigned long long) stats.blocks[2]);
+            snprintf(share, sizeof(share), "%.0f/%.0f/%.0f",
+                     100.0 * stats.executed[0] / (total ? total : 1),
+                     100.0 * stats.executed[1] / (total ? total : 1),
+                     100.0 * stats.executed[2] / (total ? total : 1));
+            auto per = [&](int tier) {
+                return stats.executed[tier]
+                     ? double(stats.nanoseconds[tier]) / stats.executed[tier] : 0.0;
+            };
+            snprintf(time, sizeof(time), "%.1f/%.1f/%.1f", per(0), per(1), per(2));
+            snprintf(ir, sizeof(ir), "%llu/%llu", (unsigned long long) stats.lifted,
+                                                  (unsigned long long) stats.lowered);
+            printf(" %20s %14s %20s %12s", blocks, share, time, ir);
+        }
+        if (use_dispatch) {
+            // Fresh instances, so both start cold
+            double ns[2];
+            uint64_t hash[2];
+            CPU::Dispatch dispatch[] = {CPU::Dispatch::calls, CPU::Dispatch::labels};
+            for (int i=0; i<2; ++i) {
+                CPU run(CPU::Mode::batch);
+                if (use_quirks)
+                    run.set_quirks(quirks);
+                run.open_rom(path);
+                if (use_tiers)
+                    run.set_tiers(tiers);
+                run.set_dispatch(dispatch[i]);
+
+                wall.start();
+                auto count = run.run(cycles);
+                wall.stop();
+                ns[i] = wall.getTime() / (count ? double(count) : 1.0);
+                hash[i] = run.hash();
+            }
+            printf(" %10.2f %10.2f %5s", ns[0], ns[1], hash[0] == hash[1] ? "yes" : "NO");
+        }
+        if (hle != Hle::Mode::off) {
+            // Counted over everything above, forks excepted
+            auto stats = cpu.hle_stats();
+            printf(" %10llu %5.1f%%", (unsigned long long) stats.replaced,
+                   100.0 * stats.instructions / n);
+            if (hle == Hle::Mode::verify)
+                printf(" %10llu", (unsigned long long) stats.mismatched);
+        }
+        printf("\n");
+    }
+
+    if (use_pairs) {
+        // Most frequent first, with their share of all pairs
+        vector<pair<uint64_t, unsigned>> counts;
+        uint64_t total = 0;
+        for (unsigned a=0; a<op_count; ++a)
+            for (unsigned b=0; b<op_count; ++b) {
+                total += pairs[a][b];
+                if (pairs[a][b])
+                    counts.push_back({pairs[a][b], a * op_count + b});
+            }
+        sort(counts.rbegin(), counts.rend());
+
+        printf("\n%-24s %14s %7s\n", "pair", "count", "share");
+        for (size_t i=0; i<counts.size() && i<20; ++i) {
+            unsigned a = counts[i].second / op_count;
+            unsigned b = counts[i].second % op_count;
+            char name[32];
+            snprintf(name, sizeof(name), "%s %s", pattern(Op(a)), pattern(Op(b)));
+            printf("%-24s %14llu %6.2f%%\n", name, (unsigned long long) counts[i].first,
+                   100.0 * counts[i].first / total);
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#include <CHIP-8/chip8_env.h>
+#include <CHIP-8/env.h>
+
+struct chip8_env {
+    Env env;
+    chip8_env (const Env::Config& config) : env(config) {}
+};
+
+chip8_env* chip8_env_create (const char* rom, const char* quirks,
+                             unsigned instances, unsigned frame_skip,
+                             unsigned frame_stack, int observation,
+                             unsigned threads)
+{
+    // Exceptions must not cross the C boundary
+    try {
+        Env::Config config;
+        config.rom         = rom ? rom : "";
+        config.quirks      = Quirks::profile(quirks ? quirks : "");
+        config.instances   = instances;
+        config.frame_skip  = frame_skip;
+        config.frame_stack = frame_stack;
+        config.threads     = threads;
+        config.observation = observation == CHIP8_ENV_BITS
+                           ? Env::Observation::bits
+                           : Env::Observation::indices;
+        return new chip8_env(config);
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+
+void chip8_env_add_reward (chip8_env* env, uint16_t addr, uint8_t bytes,
+                           float scale)
+{
+    env->env.watch({addr, bytes, scale});
+}
+
+size_t chip8_env_observation_size (chip8_env* env)
+{
+    return env->env.observation_size();
+}
+
+void chip8_env_reset (chip8_env* env, uint64_t seed, uint8_t* observations)
+{
+    env->env.reset(seed, observations);
+}
+
+void chip8_env_step (chip8_env* env, const uint8_t* actions,
+                     uint8_t* observations, float* rewards, uint8_t* dones)
+{
+    env->env.step(actions, observations, rewards, dones);
+}
+
+void chip8_env_destroy (chip8_env* env)
+{
+    delete env;
+}
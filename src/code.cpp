@@ -0,0 +1,559 @@
+#include <CHIP-8/code.h>
+#include <CHIP-8/mapping.h>
+#include <CHIP-8/rom.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <type_traits>
+
+using namespace std;
+
+static_assert(sizeof(Instr) == 8 && is_trivially_copyable<Instr>::value,
+              "Instr is written to cache files as is");
+
+namespace {
+
+bool matches (uint16_t opcode, const char* pattern)
+{
+    for (auto i=0; i<4; ++i)
+    {
+        uint8_t nibble = uint8_t(opcode >> 4*(3-i)) & 0x0F;
+
+        if (pattern[i] != 'n' &&
+            pattern[i] != 'x' &&
+            pattern[i] != 'y' &&
+            pattern[i] != to_char(nibble))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Cache file layout, in native byte order: a header, the blocks sorted by
+// start address, then every block's instructions back to back
+struct FileHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t instr_size;
+    uint64_t rom;
+    uint32_t blocks;
+    uint32_t instrs;
+};
+
+struct FileBlock {
+    uint16_t start;
+    uint16_t count;
+    uint32_t first;
+};
+
+// Instruction patterns, in Op order, which is also the order they are
+// tried in (0nnn only after every other 0___)
+const char* const patterns[] = {
+    "00E0", // CLS
+    "00EE", // RET
+    "00Cn", // SCD
+    "00Dn", // SCU
+    "00FB", // SCR
+    "00FC", // SCL
+    "00FD", // EXIT
+    "00FE", // LOW
+    "00FF", // HIGH
+    "0nnn", // SYS
+    "1nnn", // JP
+    "2nnn", // CALL
+    "3xnn", // SE_XB
+    "4xnn", // SNE_XB
+    "5xy0", // SE_XY
+    "5xy2", // SAVE_XY
+    "5xy3", // LOAD_XY
+    "6xnn", // LD_XB
+    "7xnn", // ADD_XB
+    "8xy0", // LD_XY
+    "8xy1", // OR
+    "8xy2", // AND
+    "8xy3", // XOR
+    "8xy4", // ADD_XY
+    "8xy5", // SUB
+    "8xy6", // SHR
+    "8xy7", // SUBN
+    "8xyE", // SHL
+    "9xy0", // SNE_XY
+    "Annn", // LD_I
+    "Bnnn", // JP_V
+    "Cxnn", // RND
+    "Dxyn", // DRW
+    "Ex9E", // SKP
+    "ExA1", // SKNP
+    "F000", // LONG
+    "Fn01", // PLANE
+    "F002", // AUDIO
+    "Fx07", // LD_X_DT
+    "Fx0A", // LD_X_K
+    "Fx15", // LD_DT_X
+    "Fx18", // LD_ST_X
+    "Fx1E", // ADD_I_X
+    "Fx29", // FONT
+    "Fx30", // HFONT
+    "Fx33", // BCD
+    "Fx3A", // PITCH
+    "Fx55", // SAVE
+    "Fx65", // LOAD
+    "Fx75", // SAVE_FLAGS
+    "Fx85", // LOAD_FLAGS
+};
+static_assert(sizeof(patterns) / sizeof(patterns[0]) == unsigned(Op::NONE),
+              "One pattern per operation");
+
+const char magic[8] = {'C', 'H', 'I', 'P', '8', 'B', 'L', 'K'};
+
+string file_path (const string& dir, uint64_t rom)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/%016llx-v%u.code",
+             (unsigned long long) rom, unsigned(Code::version));
+    return dir + name;
+}
+
+}
+
+// A cache file, mapped read-only. Those handed out by open() stay mapped
+// for the whole run, shared by every instance, since blocks point into them.
+class CodeFile
+{
+
+public:
+    CodeFile (const string& path, uint64_t rom) :
+        mapping(path)
+    {
+        // Anything that does not look right is ignored as a whole
+        if (!mapping.valid() || mapping.size() < sizeof(FileHeader))
+            return;
+
+        auto head = reinterpret_cast<const FileHeader*>(mapping.data());
+        if (memcmp(head->magic, magic, sizeof(magic)) != 0
+            || head->version != Code::version
+            || head->instr_size != sizeof(Instr)
+            || head->rom != rom)
+            return;
+
+        size_t expected = sizeof(FileHeader) + head->blocks * sizeof(FileBlock)
+                        + size_t(head->instrs) * sizeof(Instr);
+        if (mapping.size() != expected)
+            return;
+
+        auto list = reinterpret_cast<const FileBlock*>(head + 1);
+        for (uint32_t i=0; i<head->blocks; ++i)
+            if (size_t(list[i].first) + list[i].count > head->instrs)
+                return;
+
+        header = head;
+        blocks = list;
+        instrs = reinterpret_cast<const Instr*>(list + head->blocks);
+    }
+
+    static const CodeFile* open (const string& path, uint64_t rom)
+    {
+        static mutex files_mutex;
+        static map<string, CodeFile*> files;
+
+        lock_guard<mutex> lock(files_mutex);
+        auto &file = files[path];
+        if (!file)
+            file = new CodeFile(path, rom);
+        return file->blocks ? file : nullptr;
+    }
+
+    bool find (uint16_t start, Block& block) const
+    {
+        auto end = blocks + header->blocks;
+        auto found = lower_bound(blocks, end, start,
+            [](const FileBlock& b, uint16_t s) { return b.start < s; });
+        if (found == end || found->start != start)
+            return false;
+
+        block = {found->start, found->count, instrs + found->first, nullptr};
+        return true;
+    }
+
+    const FileBlock* all (size_t& count) const
+    {
+        count = blocks ? header->blocks : 0;
+        return blocks;
+    }
+
+    const Instr* code () const
+    {
+        return instrs;
+    }
+
+private:
+    Mapping           mapping;
+    const FileHeader* header = nullptr;
+    const FileBlock*  blocks = nullptr;
+    const Instr*      instrs = nullptr;
+};
+
+char to_char (const uint8_t& hex)
+{
+    if (hex < 10)
+        return char(hex) + '0';
+
+    else if (hex >= 10 && hex < 16)
+        return char(hex) - 10 + 'A';
+
+    else
+        return char(0);
+}
+
+Instr decode (uint16_t opcode)
+{
+    // The first operation whose pattern matches, NONE if there is none
+
+    Instr instr;
+    instr.x      = (opcode >> 8) & 0x0F;
+    instr.y      = (opcode >> 4) & 0x0F;
+    instr.n      =  opcode & 0x0F;
+    instr.addr   =  opcode & 0x0FFF;
+    instr.opcode =  opcode;
+    instr.op     =  Op::NONE;
+
+    for (unsigned op=0; op<unsigned(Op::NONE); ++op)
+        if (matches(opcode, patterns[op])) {
+            instr.op = Op(op);
+            break;
+        }
+    return instr;
+}
+
+const char* pattern (Op op)
+{
+    return op == Op::NONE ? "????" : patterns[unsigned(op)];
+}
+
+bool ends_block (Op op)
+{
+    // Control leaves for somewhere else, or memory may be written
+    // (possibly the rest of the block)
+
+    switch (op) {
+        case Op::RET:  case Op::EXIT: case Op::JP:      case Op::CALL:
+        case Op::JP_V: case Op::BCD:  case Op::SAVE:    case Op::SAVE_XY:
+            return true;
+        default:
+            return false;
+    }
+}
+
+Code::Code ()
+{
+}
+
+Code::~Code ()
+{
+}
+
+const Block* Code::find (const Memory& RAM, uint16_t pc, const Handlers* table)
+{
+    // Block starting at pc in the highest tier it has reached, nullptr
+    // while it is still interpreted (or its first instruction straddles
+    // two pages)
+
+    auto &slot = pages[pc / Memory::page_size];
+    if (!slot)
+        slot.reset(new Page);
+    Page& page = *slot;
+    unsigned offset = pc % Memory::page_size;
+
+    uint64_t digest = RAM.digest(pc / Memory::page_size);
+    if (digest != page.digest) {
+        verify(page, RAM);
+        page.digest = digest;
+    }
+
+    Entry* entry = page.starts[offset];
+    if (!entry) {
+        // Blocks in the cache file cost nothing to decode
+        auto &heat = page.heat[offset];
+        if (heat < thresholds.decode) {
+            if (heat++ == 0)
+                ++counters.blocks[0];
+            entry = cached(page, RAM, pc);
+        }
+        else
+            entry = translate(page, RAM, pc);
+        if (!entry)
+            return nullptr;
+    }
+
+    if (entry->table != table && entry->runs >= thresholds.thread)
+        thread(*entry, table);
+    else if (entry->runs < thresholds.thread)
+        ++entry->runs;
+    return &entry->block;
+}
+
+void Code::account (unsigned tier, uint64_t instructions, uint64_t nanoseconds)
+{
+    counters.executed[tier] += instructions;
+    counters.nanoseconds[tier] += nanoseconds;
+}
+
+void Code::set_tiers (Tiers tiers)
+{
+    thresholds = tiers;
+}
+
+const Code::Tiers& Code::tiers ()
+{
+    return thresholds;
+}
+
+void Code::verify (Page& page, const Memory& RAM)
+{
+    // Drops the blocks whose instructions are no longer in memory
+
+    auto stale = [&](const unique_ptr<Entry>& entry) {
+        const Block& block = entry->block;
+        uint16_t addr = block.start;
+        for (unsigned i=0; i<block.count; ++i) {
+            const Instr& instr = block.code[i];
+            if (((RAM[addr] << 8) | RAM[uint16_t(addr + 1)]) != instr.opcode) {
+                page.starts[block.start % Memory::page_size] = nullptr;
+                ++counters.invalidated;
+                return true;
+            }
+            addr = uint16_t(addr + instr.size());
+        }
+        return false;
+    };
+
+    auto &entries = page.entries;
+    entries.erase(remove_if(entries.begin(), entries.end(), stale), entries.end());
+}
+
+Code::Entry* Code::cached (Page& page, const Memory& RAM, uint16_t pc)
+{
+    // The block at pc from the cache file, if it still matches memory
+
+    if (!file_opened && !cache_dir.empty()) {
+        file = CodeFile::open(file_path(cache_dir, rom), rom);
+        file_opened = true;
+    }
+
+    unique_ptr<Entry> entry(new Entry);
+    if (!file || !file->find(pc, entry->block) || entry->block.count == 0)
+        return nullptr;
+
+    unsigned limit = (pc / Memory::page_size + 1) * Memory::page_size;
+    unsigned addr = pc;
+    for (unsigned i=0; i<entry->block.count; ++i) {
+        const Instr& instr = entry->block.code[i];
+        if (addr + instr.size() > limit
+            || ((RAM[uint16_t(addr)] << 8) | RAM[uint16_t(addr + 1)]) != instr.opcode)
+            return nullptr;
+        addr += instr.size();
+    }
+
+    ++counters.loaded;
+    return add(page, move(entry));
+}
+
+Code::Entry* Code::translate (Page& page, const Memory& RAM, uint16_t pc)
+{
+    // The cache file first, then the decoder. Either way the block stays
+    // within the page, so only that page's changes can affect it.
+
+    if (Entry* entry = cached(page, RAM, pc))
+        return entry;
+
+    unsigned limit = (pc / Memory::page_size + 1) * Memory::page_size;
+
+    unique_ptr<Entry> entry(new Entry);
+    auto &decoded = entry->decoded;
+    unsigned addr = pc;
+    while (decoded.size() < max_block && addr + 2 <= limit) {
+        Instr instr = decode(uint16_t((RAM[uint16_t(addr)] << 8) | RAM[uint16_t(addr + 1)]));
+        if (addr + instr.size() > limit)
+            break;
+        decoded.push_back(instr);
+        addr += instr.size();
+        if (ends_block(instr.op))
+            break;
+    }
+    if (decoded.empty())
+        return nullptr;
+
+    entry->block = {pc, uint16_t(decoded.size()), decoded.data(), nullptr};
+    ++counters.decoded;
+    return add(page, move(entry));
+}
+
+Code::Entry* Code::add (Page& page, unique_ptr<Entry> entry)
+{
+    ++counters.blocks[1];
+    page.starts[entry->block.start % Memory::page_size] = entry.get();
+    page.entries.push_back(move(entry));
+    return page.entries.back().get();
+}
+
+void Code::thread (Entry& entry, const Handlers* table)
+{
+    // Tier 2: each instruction's handler looked up once, and the longest
+    // fusion starting there, unless a longer run of register operations
+    // starts there, which is lifted to IR. A new table (the quirk profile
+    // changed) replaces the old steps.
+
+    if (!entry.table)
+        ++counters.blocks[2];
+
+    const Instr* code = entry.block.code;
+    unsigned count = entry.block.count;
+
+    entry.steps.clear();
+    entry.lifted.clear();
+    unsigned run_end = 0; // Of the last lifted run
+    for (unsigned i=0; i<count; ++i) {
+        Step step = {table->single[size_t(code[i].op)], nullptr, 1};
+
+        for (size_t f=0; f<table->fusion_count && !step.fused; ++f) {
+            const Fusion& fusion = table->fusions[f];
+            bool match = i + fusion.length <= count;
+            for (unsigned k=0; k<fusion.length && match; ++k)
+                match = code[i + k].op == fusion.ops[k];
+            if (match)
+                step = {step.single, fusion.handler, fusion.length};
+        }
+
+        unsigned end = i;
+        while (end < count && Ir::lifts(code[end]))
+            ++end;
+        if (i >= run_end && end - i >= 2 && end - i > step.length) {
+            auto ir = make_unique<Ir>();
+            ir->lift(code + i, end - i, table->ir);
+            counters.lifted += end - i;
+            counters.lowered += ir->size();
+            step = {step.single, nullptr, end - i, ir.get()};
+            entry.lifted.push_back(move(ir));
+            run_end = end;
+        }
+        entry.steps.push_back(step);
+    }
+    entry.table = table;
+    entry.block.steps = entry.steps.data();
+}
+
+void Code::use_cache (const string& dir, uint64_t rom)
+{
+    // The file itself is only opened when the first block is needed
+
+    cache_dir = dir;
+    this->rom = rom;
+    file = nullptr;
+    file_opened = false;
+}
+
+void Code::save ()
+{
+    // Merges the blocks decoded from the rom's own bytes into its cache
+    // file. The new file replaces the old one in a single rename, so
+    // readers see either.
+
+    const Rom* image = Rom::find(rom);
+    if (cache_dir.empty() || !image)
+        return;
+
+    // Start address -> instructions, the file's blocks taking precedence
+    map<uint16_t, vector<Instr>> merged;
+
+    auto from_rom = [&](const Block& block) {
+        size_t addr = block.start;
+        for (unsigned i=0; i<block.count; ++i) {
+            const Instr& instr = block.code[i];
+            size_t offset = addr - 0x200;
+            if (addr < 0x200 || offset + 2 > image->size())
+                return false;
+            const uint8_t* bytes = image->data() + offset;
+            if (((bytes[0] << 8) | bytes[1]) != instr.opcode)
+                return false;
+            addr += instr.size();
+        }
+        return true;
+    };
+
+    // Read afresh: the file may have grown since this process mapped it
+    string path = file_path(cache_dir, rom);
+    {
+        CodeFile existing(path, rom);
+        size_t count;
+        auto blocks = existing.all(count);
+        for (size_t i=0; i<count; ++i) {
+            const Instr* code = existing.code() + blocks[i].first;
+            merged[blocks[i].start].assign(code, code + blocks[i].count);
+        }
+    }
+    size_t before = merged.size();
+
+    for (auto &page : pages) {
+        if (!page)
+            continue;
+        for (auto &entry : page->entries) {
+            const Block& block = entry->block;
+            if (!merged.count(block.start) && from_rom(block))
+                merged[block.start].assign(block.code, block.code + block.count);
+        }
+    }
+    if (merged.size() == before)
+        return;
+
+    FileHeader header;
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version    = version;
+    header.instr_size = sizeof(Instr);
+    header.rom        = rom;
+    header.blocks     = uint32_t(merged.size());
+    header.instrs     = 0;
+
+    vector<FileBlock> blocks;
+    vector<Instr>     instrs;
+    for (auto &block : merged) {
+        blocks.push_back({block.first, uint16_t(block.second.size()),
+                          uint32_t(instrs.size())});
+        instrs.insert(instrs.end(), block.second.begin(), block.second.end());
+    }
+    header.instrs = uint32_t(instrs.size());
+
+    string temporary = path + "." + to_string(
+        chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+
+    FILE* out = fopen(temporary.c_str(), "wb");
+    if (!out)
+        return;
+    bool written = fwrite(&header, sizeof(header), 1, out) == 1
+                && fwrite(blocks.data(), sizeof(FileBlock), blocks.size(), out) == blocks.size()
+                && fwrite(instrs.data(), sizeof(Instr), instrs.size(), out) == instrs.size();
+    written = fclose(out) == 0 && written;
+
+#ifdef _WIN32
+    if (written)
+        remove(path.c_str());
+#endif
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0)
+        remove(temporary.c_str());
+}
+
+Code::Stats Code::stats ()
+{
+    return counters;
+}
+
+void Code::reset_stats ()
+{
+    // Zeroes the stats, keeping the blocks, which stay valid
+
+    counters = Stats();
+}
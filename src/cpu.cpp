@@ -1,233 +1,1558 @@
 #include <CHIP-8/cpu.h>
+#include <CHIP-8/hash.h>
+#include <CHIP-8/rom.h>
+#include <CHIP-8/trace.h>
 #include <bitset>
 #include <cstdlib>
-#include <fstream>
+#include <ctime>
+#include <mutex>
+#include <stdexcept>
 
 using u8 = uint8_t;
 using u16 = uint16_t;
 using namespace std;
 
-CPU::CPU(): io(IO("CHIP-8 Emulator", width, height, 15))
+namespace {
+
+// Dead branches, kept for the whole run
+mutex       arena_mutex;
+vector<CPU*> arena;
+
+// 4x5 digits, at 0x100 + 16 * digit
+const u8 font[16][5] = {
+    {0xF0, 0x90, 0x90, 0x90, 0xF0}, // 0
+    {0x20, 0x60, 0x20, 0x20, 0x70}, // 1
+    {0xF0, 0x10, 0xF0, 0x80, 0xF0}, // 2
+    {0xF0, 0x10, 0xF0, 0x10, 0xF0}, // 3
+    {0x90, 0x90, 0xF0, 0x10, 0x10}, // 4
+    {0xF0, 0x80, 0xF0, 0x10, 0xF0}, // 5
+    {0xF0, 0x80, 0xF0, 0x90, 0xF0}, // 6
+    {0xF0, 0x10, 0x20, 0x40, 0x40}, // 7
+    {0xF0, 0x90, 0xF0, 0x90, 0xF0}, // 8
+    {0xF0, 0x90, 0xF0, 0x10, 0xF0}, // 9
+    {0xF0, 0x90, 0xF0, 0x90, 0x90}, // A
+    {0xE0, 0x90, 0xE0, 0x90, 0xE0}, // B
+    {0xF0, 0x80, 0x80, 0x80, 0xF0}, // C
+    {0xE0, 0x90, 0x90, 0x90, 0xE0}, // D
+    {0xF0, 0x80, 0xF0, 0x80, 0xF0}, // E
+    {0xF0, 0x80, 0xF0, 0x80, 0x80}, // F
+};
+
+// SUPER-CHIP 8x10 digits, at 10 * digit
+const u8 hires_font[10][10] = {
+    {0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C}, // 0
+    {0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C}, // 1
+    {0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF}, // 2
+    {0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C}, // 3
+    {0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06}, // 4
+    {0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C}, // 5
+    {0x3E, 0x7C, 0xE0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C}, // 6
+    {0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60}, // 7
+    {0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C}, // 8
+    {0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C}, // 9
+};
+
+}
+
+CPU::CPU(Mode mode):
+    mode(mode),
+    io(mode == Mode::batch ? IO()
+                           : IO("CHIP-8 Emulator", width, height, 15))
 {
     DT = 0;
     ST = 0;
     I  = 0x0;
     PC = 0x200;
     SP = 0xEA0;
+    PITCH = 64;
+
+    // Batch runs are reproducible, interactive ones aren't
+    RNG = mode == Mode::batch ? 0x2545F491 : u32(time(nullptr)) | 1;
 
     for (auto &data : V)
         data = 0x00;
-    for (auto &data : RAM)
+    for (auto &data : RPL)
+        data = 0x00;
+    for (auto &data : PATTERN)
         data = 0x00;
 
+    // RAM starts out as shared zero pages, the fonts as shared copies
     init_fonts();
 
+    if (mode == Mode::interactive)
+        audio.start_device();
+
     cpu_timer.start();
     delay_timer.start();
 }
 
 void CPU::init_fonts ()
 {
-    LD(0x100, vec<u8>{0xF0, 0x90, 0x90, 0x90, 0xF0}); // 0
-    LD(0x110, vec<u8>{0x20, 0x60, 0x20, 0x20, 0x70}); // 1
-    LD(0x120, vec<u8>{0xF0, 0x10, 0xF0, 0x80, 0xF0}); // 2
-    LD(0x130, vec<u8>{0xF0, 0x10, 0xF0, 0x10, 0xF0}); // 3
-    LD(0x140, vec<u8>{0x90, 0x90, 0xF0, 0x10, 0x10}); // 4
-    LD(0x150, vec<u8>{0xF0, 0x80, 0xF0, 0x10, 0xF0}); // 5
-    LD(0x160, vec<u8>{0xF0, 0x80, 0xF0, 0x90, 0xF0}); // 6
-    LD(0x170, vec<u8>{0xF0, 0x10, 0x20, 0x40, 0x40}); // 7
-    LD(0x180, vec<u8>{0xF0, 0x90, 0xF0, 0x90, 0xF0}); // 8
-    LD(0x190, vec<u8>{0xF0, 0x90, 0xF0, 0x10, 0xF0}); // 9
-    LD(0x1A0, vec<u8>{0xF0, 0x90, 0xF0, 0x90, 0x90}); // A
-    LD(0x1B0, vec<u8>{0xE0, 0x90, 0xE0, 0x90, 0xE0}); // B
-    LD(0x1C0, vec<u8>{0xF0, 0x80, 0x80, 0x80, 0xF0}); // C
-    LD(0x1D0, vec<u8>{0xE0, 0x90, 0x90, 0x90, 0xE0}); // D
-    LD(0x1E0, vec<u8>{0xF0, 0x80, 0xF0, 0x80, 0xF0}); // E
-    LD(0x1F0, vec<u8>{0xF0, 0x80, 0xF0, 0x80, 0x80}); // F
+    // Written once, every instance then starts out sharing the same pages
+    static const Memory* booted = [] {
+        auto memory = new Memory;
+        for (unsigned digit=0; digit<16; ++digit)
+            for (unsigned row=0; row<5; ++row)
+                memory->write(u16(0x100 + digit*16 + row), font[digit][row]);
+        memory->share();
+        return memory;
+    }();
+
+    RAM = *booted;
+}
+
+void CPU::init_hires_fonts ()
+{
+    // SUPER-CHIP 8x10 digits, only present on the profiles that have Fx30
+    for (unsigned digit=0; digit<10; ++digit)
+        for (unsigned row=0; row<10; ++row)
+            RAM.write(u16(digit*10 + row), hires_font[digit][row]);
 }
 
 void CPU::open_rom (string path)
 {
-    ifstream rom(path, ios::binary);
-    if (!rom.is_open())
-        return;
+    // Throws runtime_error if the rom cannot be read or does not fit below
+    // the stack of its profile: the one set before, if any, otherwise the
+    // one known for the rom
+
+    const Rom& rom = Rom::open(path);
+    auto info = rom.info();
+    if (info && !quirks_set)
+        use_quirks(info->quirks);
+    if (rom.size() > size_t(program_end - 0x200))
+        throw runtime_error("El rom no cabe en la memoria: " + path);
 
     // Carga el rom a la memoria
-    char byte;
-    for (size_t i=0x200; rom.get(byte); ++i)
-        RAM[i] = u8(byte);
+    RAM.load(0x200, rom.data(), rom.size());
+    rom_hash = rom.hash();
+    rom_size = rom.size();
+    if (!code_dir.empty())
+        code.use_cache(code_dir, rom_hash);
+
+    // Other instances running this rom hold the same pages
+    RAM.share();
+
+    if (info)
+        idle_skip = info->idle_skip;
+    for (auto &future : futures)
+        future->idle_skip = idle_skip;
 }
 
-IO::Sprite to_sprite(const u8& byte)
+u16 CPU::stack_top ()
 {
-    IO::Sprite sprite;
+    auto first  = u16(RAM[SP - 2]);
+    auto second = u16(RAM[SP - 1]);
+    auto top = u16((first << 8) | second);
+    return top;
+}
 
-    for (u8 i=0; i<8; ++i) {
-        bool bit = (byte >> (7-i)) & 0x01;
-        if (bit)
-            sprite[i] = 0xFFFFFFFF;
-        else
-            sprite[i] = 0x000000FF;
+void CPU::stack_pop ()
+{
+    SP -= 2;
+}
+
+void CPU::stack_push (u16 address)
+{
+    RAM.write(SP + 0, address >> 8);
+    RAM.write(SP + 1, address & 0x00FF);
+    SP += 2;
+}
+
+void CPU::set_quirks (Quirks::Profile profile)
+{
+    // Set before open_rom, wins over the profile known for the rom. Throws
+    // runtime_error if the rom already open does not fit below its stack.
+
+    if (rom_size > size_t(program_end_of(profile) - 0x200))
+        throw runtime_error("El rom no cabe en la memoria con este perfil");
+
+    quirks_set = true;
+    use_quirks(profile);
+}
+
+CPU::u16 CPU::program_end_of (Quirks::Profile profile)
+{
+    // XO-CHIP programs may use the whole address space, so the stack moves
+    // to the top of it
+    return profile == Quirks::Profile::xochip ? 0xFFA0 : 0xEA0;
+}
+
+void CPU::use_quirks (Quirks::Profile profile)
+{
+    quirks = profile;
+
+    if (profile == Quirks::Profile::schip || profile == Quirks::Profile::xochip) {
+        init_hires_fonts();
+        RAM.share();
     }
-    return sprite;
+
+    program_end = SP = program_end_of(profile);
+
+    for (auto &future : futures)
+        future->set_quirks(profile);
 }
 
-char to_char (const u8& hex)
+void CPU::record_audio (string path)
 {
-    if (hex < 10)
-        return char(hex) + '0';
+    // Writes the beeper of a batch run to a WAV file
+
+    audio.start_wav(path);
+}
 
-    else if (hex >= 10 && hex < 16)
-        return char(hex) - 10 + 'A';
+void CPU::sync_to_audio ()
+{
+    // Paces interactive runs by the audio device instead of the wall
+    // clock, if there is one
 
-    else
-        return char(0);
+    audio_clock = audio.sync();
 }
 
-bool CPU::matches(u16 opcode, const char* pattern)
+void CPU::set_run_ahead (unsigned frames)
 {
-    for (auto i=0; i<4; ++i)
-    {
-        u8 nibble = u8(opcode >> 4*(3-i)) & 0x0F;
+    // Shows, every frame, the screen the given number of frames ahead with
+    // the current input held, hiding that much input latency
+
+    ahead_frames = frames;
+    if (frames > 0 && !timeline)
+        timeline.reset(new State);
+    io.hold_display(frames > 0);
+}
+
+void CPU::set_speculative (bool enabled)
+{
+    // Runs every frame ahead of time once per possible key state on worker
+    // threads, so when the frame is due its result only has to be picked
+
+    if (!enabled) {
+        futures.clear();
+        return;
+    }
+
+    if (!timeline)
+        timeline.reset(new State);
+    if (!pool)
+        pool.reset(new Pool(max(2u, thread::hardware_concurrency()) - 1));
 
-        if (pattern[i] != 'n' &&
-            pattern[i] != 'x' &&
-            pattern[i] != 'y' &&
-            pattern[i] != to_char(nibble))
+    futures.clear();
+    for (unsigned key = 0; key < 17; ++key) {
+        futures.emplace_back(new CPU(Mode::batch));
+        futures.back()->set_quirks(quirks);
+        futures.back()->speculating = true;
+    }
+    io.hold_display(true);
+}
+
+void CPU::run ()
+{
+    // The interpreter instance for the quirk profile is picked only once
+
+    switch (quirks) {
+        case Quirks::Profile::vip:    run_with<Quirks::VIP>();
+        case Quirks::Profile::schip:  run_with<Quirks::SCHIP>();
+        case Quirks::Profile::xochip: run_with<Quirks::XOCHIP>();
+        default:                      run_with<Quirks::Modern>();
+    }
+}
+
+uint64_t CPU::run (uint64_t cycles)
+{
+    // Runs up to the given number of instructions without real-time pacing
+    // and returns how many were executed (fewer if the program stopped).
+    // Cycles spent waiting on Fx0A for a key count as executed.
+
+    switch (quirks) {
+        case Quirks::Profile::vip:    return run_with<Quirks::VIP>(cycles);
+        case Quirks::Profile::schip:  return run_with<Quirks::SCHIP>(cycles);
+        case Quirks::Profile::xochip: return run_with<Quirks::XOCHIP>(cycles);
+        default:                      return run_with<Quirks::Modern>(cycles);
+    }
+}
+
+void CPU::advance (uint64_t frames)
+{
+    // Runs whole frames in virtual time with the key held as it is, for
+    // headless instances that are always stepped this way
+
+    switch (quirks) {
+        case Quirks::Profile::vip:    return run_frames<Quirks::VIP>(frames);
+        case Quirks::Profile::schip:  return run_frames<Quirks::SCHIP>(frames);
+        case Quirks::Profile::xochip: return run_frames<Quirks::XOCHIP>(frames);
+        default:                      return run_frames<Quirks::Modern>(frames);
+    }
+}
+
+template <typename Q>
+void CPU::run_with ()
+{
+    Trace::thread_name("CPU");
+
+    if (!futures.empty())
+        run_speculative<Q>();
+
+    while (true) {
+        {
+            Trace::Zone zone("input");
+            io.update();
+        }
+        auto last_PC = PC;
         {
-            return false;
+            Trace::Zone zone("execute");
+            auto opcode = fetch();
+            execute<Q>(opcode);
         }
+        auto last_tick = ticks;
+        update_timers();
+
+        if (ahead_frames > 0 && ticks != last_tick)
+            run_ahead<Q>();
+
+        if (PC < last_PC)
+            sleep_idle_loop();
+
+        if (PC >= program_end)
+            exit(EXIT_FAILURE);
     }
-    return true;
 }
 
-u8& CPU::screen_byte (u8 x, u8 y)
+template <typename Q>
+uint64_t CPU::run_with (uint64_t cycles)
 {
-    u16 index = (8 * y) + x;
-    return (RAM[0xF00 + index]);
+    uint64_t executed = 0;
+    while (executed < cycles && current_status == Status::running) {
+        run_block<Q>([&](const Instr* instr, unsigned length, auto&& execute) {
+            // Fx0A with no key held only lets time pass, as no key can be
+            // pressed before the run ends: up to the budget or the next
+            // watchdog check, whichever comes first
+            if (instr->op == Op::LD_X_K && io.last_key() == 0xFF) {
+                u64 check = (this->cycles / watchdog_period + 1) * watchdog_period;
+                u64 end = min(check, this->cycles + (cycles - executed));
+                executed += end - this->cycles;
+                pass_time(end);
+                if (this->cycles % watchdog_period == 0)
+                    watchdog();
+                return false;
+            }
+
+            Trace::Zone zone("execute");
+            auto last_PC = PC;
+            unsigned ran = execute(together(instr, length, cycles - executed));
+
+            // Bookkeeping of the instructions that ran, as if one by one
+            for (unsigned i=1; i<ran; ++i)
+                last_PC += instr[i-1].size();
+            for (unsigned i=0; i<ran; ++i)
+                tick_timers();
+            executed += ran;
+
+            if (instr[ran-1].op == Op::CALL)
+                executed += call_routine<Q>(cycles - executed);
+
+            if (PC < last_PC) {
+                executed += skip_idle_loop(cycles - executed);
+                executed += skip_counting_loop(cycles - executed);
+            }
+
+            if (PC >= program_end)
+                current_status = Status::crashed;
+
+            if (this->cycles / watchdog_period != (this->cycles - 1) / watchdog_period)
+                watchdog();
+
+            return executed < cycles && current_status == Status::running
+                && PC == u16(last_PC + instr[ran-1].size());
+        });
+    }
+
+    // Lets a recording reach the end of the run
+    post_sound(sound, this->cycles);
+    return executed;
 }
 
-u16 CPU::stack_top ()
+template <typename Q, typename Each>
+void CPU::run_block (Each each)
 {
-    auto first  = u16(RAM[SP - 2]);
-    auto second = u16(RAM[SP - 1]);
-    auto top = u16((first << 8) | second);
-    return top;
+    // Runs from PC to the end of its block, in the tier the block has
+    // reached. each(instrs, length, execute) wraps the caller's bookkeeping
+    // around execute(n), which runs up to n of the length instructions
+    // (more than one only for a superinstruction) and returns how many
+    // ran. each returns false to leave the block early.
+
+    const Block* block = pairs ? nullptr : code.find(RAM, PC, handlers<Q>());
+    bool timed = code.tiers().timed;
+    auto begin = timed ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+    u64 count = 0;
+    unsigned tier;
+
+    if (!block) {
+        // Tier 0: decoded as it runs, up to where its block would end
+        tier = 0;
+        u16 start = PC;
+        Instr instr;
+        Op last = Op::NONE;
+        do {
+            instr = decode(fetch());
+            if (pairs && last != Op::NONE)
+                ++(*pairs)[size_t(last)][size_t(instr.op)];
+            last = instr.op;
+        } while (each(&instr, 1, [&](unsigned) { execute<Q>(instr); ++count; return 1u; })
+                 && !ends_block(instr.op)
+                 && PC / Memory::page_size == start / Memory::page_size);
+    }
+    else if (!block->steps) {
+        tier = 1;
+        for (unsigned i=0; i<block->count; ++i) {
+            const Instr& instr = block->code[i];
+            if (!each(&instr, 1, [&](unsigned) { execute<Q>(instr); ++count; return 1u; }))
+                break;
+        }
+    }
+    else {
+        tier = 2;
+#ifdef CHIP8_COMPUTED_GOTO
+        if (dispatch == Dispatch::labels)
+            run_labels<Q>(*block, each, count);
+        else
+#endif
+        for (unsigned i=0; i<block->count; ) {
+            const Step&  step  = block->steps[i];
+            const Instr* instr = block->code + i;
+            unsigned ran = 0;
+            bool more = each(instr, step.length, [&](unsigned n) {
+                ran = n == 1  ? step.single(*this, instr)
+                    : step.ir ? run_ir(*step.ir, n)
+                    :           step.fused(*this, instr);
+                count += ran;
+                return ran;
+            });
+            if (!more)
+                break;
+            i += ran;
+        }
+    }
+
+    u64 spent = timed ? u64(chrono::duration_cast<chrono::nanoseconds>(
+                            chrono::steady_clock::now() - begin).count()) : 0;
+    code.account(tier, count, spent);
 }
 
-void CPU::stack_pop ()
+unsigned CPU::together (const Instr* instr, unsigned length, u64 budget)
 {
-    SP -= 2;
+    // How many of the length instructions from PC on may run as one: all
+    // of them if none but the last uses up the budget, reaches a watchdog
+    // check or leaves program memory, otherwise just the first
+
+    if (length == 1 || length > budget)
+        return 1;
+    if ((cycles + length - 1) / watchdog_period != cycles / watchdog_period)
+        return 1;
+
+    u16 last = PC;
+    for (unsigned i=0; i+1<length; ++i)
+        last += instr[i].size();
+    return last < program_end ? length : 1;
 }
 
-void CPU::stack_push (u16 address)
+unsigned CPU::run_ir (const Ir& ir, unsigned length)
 {
-    RAM[SP + 0] = address >> 8;
-    RAM[SP + 1] = address & 0x00FF;
-    SP += 2;
+    // Runs length lifted register operations at once. None of them jumps,
+    // and VF is settled first since the IR computes its flags eagerly.
+
+    resolve_flag();
+    ir.run(V.data(), I);
+    PC = u16(PC + 2 * length);
+    return length;
 }
 
-void CPU::run ()
+#ifdef CHIP8_COMPUTED_GOTO
+template <typename Q, typename Each>
+void CPU::run_labels (const Block& block, Each& each, u64& count)
 {
+    // Tier 2 with GCC/Clang labels as values: every handler ends in its
+    // own indirect jump to the next, so each gets its own prediction.
+    // Superinstructions and IR runs share one label, as in run_block.
+
+    const Instr* instr = block.code;
+    const Instr* end   = block.code + block.count;
+    const Step*  current;
+
+    #define LABEL(op) &&op_##op,
+    static void* const labels[] = {
+        LABEL(CLS)     LABEL(RET)     LABEL(SCD)     LABEL(SCU)     LABEL(SCR)
+        LABEL(SCL)     LABEL(EXIT)    LABEL(LOW)     LABEL(HIGH)    LABEL(SYS)
+        LABEL(JP)      LABEL(CALL)    LABEL(SE_XB)   LABEL(SNE_XB)  LABEL(SE_XY)
+        LABEL(SAVE_XY) LABEL(LOAD_XY) LABEL(LD_XB)   LABEL(ADD_XB)  LABEL(LD_XY)
+        LABEL(OR)      LABEL(AND)     LABEL(XOR)     LABEL(ADD_XY)  LABEL(SUB)
+        LABEL(SHR)     LABEL(SUBN)    LABEL(SHL)     LABEL(SNE_XY)  LABEL(LD_I)
+        LABEL(JP_V)    LABEL(RND)     LABEL(DRW)     LABEL(SKP)     LABEL(SKNP)
+        LABEL(LONG)    LABEL(PLANE)   LABEL(AUDIO)   LABEL(LD_X_DT) LABEL(LD_X_K)
+        LABEL(LD_DT_X) LABEL(LD_ST_X) LABEL(ADD_I_X) LABEL(FONT)    LABEL(HFONT)
+        LABEL(BCD)     LABEL(PITCH)   LABEL(SAVE)    LABEL(LOAD)    LABEL(SAVE_FLAGS)
+        LABEL(LOAD_FLAGS) LABEL(NONE)
+    };
+    static_assert(sizeof(labels) / sizeof(labels[0]) == size_t(Op::NONE) + 1,
+                  "One label per operation");
+    #undef LABEL
+
+    #define DISPATCH { \
+        if (instr == end) return; \
+        current = block.steps + (instr - block.code); \
+        goto *(current->length > 1 ? &&fused : labels[size_t(instr->op)]); }
+    #define OP(op) op_##op: \
+        if (!each(instr, 1, [&](unsigned) { perform<Q, Op::op>(*instr); ++count; return 1u; })) \
+            return; \
+        ++instr; \
+        DISPATCH
+
+    DISPATCH
+    OP(CLS)     OP(RET)     OP(SCD)     OP(SCU)     OP(SCR)
+    OP(SCL)     OP(EXIT)    OP(LOW)     OP(HIGH)    OP(SYS)
+    OP(JP)      OP(CALL)    OP(SE_XB)   OP(SNE_XB)  OP(SE_XY)
+    OP(SAVE_XY) OP(LOAD_XY) OP(LD_XB)   OP(ADD_XB)  OP(LD_XY)
+    OP(OR)      OP(AND)     OP(XOR)     OP(ADD_XY)  OP(SUB)
+    OP(SHR)     OP(SUBN)    OP(SHL)     OP(SNE_XY)  OP(LD_I)
+    OP(JP_V)    OP(RND)     OP(DRW)     OP(SKP)     OP(SKNP)
+    OP(LONG)    OP(PLANE)   OP(AUDIO)   OP(LD_X_DT) OP(LD_X_K)
+    OP(LD_DT_X) OP(LD_ST_X) OP(ADD_I_X) OP(FONT)    OP(HFONT)
+    OP(BCD)     OP(PITCH)   OP(SAVE)    OP(LOAD)    OP(SAVE_FLAGS)
+    OP(LOAD_FLAGS) OP(NONE)
+
+    fused: {
+        unsigned ran = 0;
+        if (!each(instr, current->length, [&](unsigned n) {
+                ran = n == 1     ? current->single(*this, instr)
+                    : current->ir ? run_ir(*current->ir, n)
+                    :               current->fused(*this, instr);
+                count += ran;
+                return ran;
+            }))
+            return;
+        instr += ran;
+        DISPATCH
+    }
+
+    #undef OP
+    #undef DISPATCH
+}
+#endif
+
+template <typename Q>
+void CPU::run_ahead ()
+{
+    // Runs ahead_frames frames on a throwaway timeline, presents its last
+    // screen and rewinds. Called right after a tick, so virtual time can
+    // start from that frame boundary.
+
+    Trace::Zone zone("run-ahead");
+    save(*timeline);
+    speculating = true;
+
+    cycles = (ticks * clock_rate + timer_rate - 1) / timer_rate;
+    run_frames<Q>(ahead_frames);
+
+    io.present();
+    speculating = false;
+    load(*timeline);
+}
+
+template <typename Q>
+void CPU::run_frames (uint64_t frames)
+{
+    // Runs whole frames in virtual time, starting on a frame boundary, with
+    // the key held as it is. Waiting on Fx0A with no key only lets time pass.
+    // The watchdog retires hung machines, except on the run-ahead and
+    // speculative timelines, where a key may still come in from the player.
+
+    u64 target = ticks + frames;
+    u64 boundary = (target * clock_rate + timer_rate - 1) / timer_rate;
+    auto check = [this] {
+        if (!speculating && current_status == Status::running
+            && cycles / watchdog_period != (cycles - 1) / watchdog_period)
+            watchdog();
+    };
+
+    while (ticks < target && current_status == Status::running) {
+        run_block<Q>([&](const Instr* instr, unsigned length, auto&& execute) {
+            if (instr->op == Op::LD_X_K && io.last_key() == 0xFF) {
+                if (coverage)
+                    (*coverage)[PC] = true;
+                tick_timers();
+                check();
+                return false;
+            }
+
+            auto last_PC = PC;
+            unsigned ran = execute(together(instr, length, boundary - cycles));
+
+            for (unsigned i=0; i<ran; ++i) {
+                if (i > 0)
+                    last_PC += instr[i-1].size();
+                if (coverage)
+                    (*coverage)[last_PC] = true;
+                tick_timers();
+            }
+
+            if (instr[ran-1].op == Op::CALL && cycles < boundary)
+                call_routine<Q>(boundary - cycles);
+
+            if (PC < last_PC && cycles < boundary) {
+                skip_idle_loop(boundary - cycles);
+                skip_counting_loop(boundary - cycles);
+            }
+
+            if (PC >= program_end)
+                current_status = Status::crashed;
+
+            check();
+
+            return ticks < target && current_status == Status::running
+                && PC == u16(last_PC + instr[ran-1].size());
+        });
+    }
+}
+
+template <typename Q>
+void CPU::run_speculative ()
+{
+    // Frame by frame: while a frame plays, its successor is computed for
+    // every key state. When it is due, the input is read once and the
+    // matching future becomes the real timeline.
+
+    speculate<Q>();
+
     while (true) {
-        io.update();
-        auto opcode = fetch();
-        execute(opcode);
-        update_timers();
+        {
+            Trace::Zone zone("input");
+            if (audio_clock)
+                audio.pace((ticks + 1) * Audio::sample_rate / timer_rate);
+            else
+                while (delay_timer.getTime() < 1000000/60) {
+                    io.update();
+                    SDL_Delay(1);
+                }
+            delay_timer.start();
+            io.update();
+        }
 
-        if (PC >= 0xEA0)
+        Trace::Zone zone("commit");
+        for (auto &job : pending)
+            job.get();
+
+        auto key = io.last_key();
+        auto &future = *futures[key == 0xFF ? 0 : key + 1];
+        future.save(*timeline);
+
+        bool beeping = sound;
+        auto pattern = PATTERN;
+        auto pitch = PITCH;
+        load(*timeline);
+        sound = beeping;
+        if ((ST != 0) != sound)
+            post_sound(ST != 0, cycles);
+        if (PATTERN != pattern || PITCH != pitch)
+            post_voice(cycles);
+        Trace::frame(ticks);
+        io.present();
+
+        if (current_status == Status::crashed)
             exit(EXIT_FAILURE);
+        if (current_status == Status::exited)
+            exit(EXIT_SUCCESS);
+
+        speculate<Q>();
+    }
+}
+
+template <typename Q>
+void CPU::speculate ()
+{
+    // Starts the next frame from the current state on every future, one
+    // per key state: released, then keys 0 to F
+
+    save(*timeline);
+    pending.clear();
+
+    for (unsigned i=0; i<futures.size(); ++i) {
+        pending.push_back(pool->submit([this, i] {
+            auto &future = *futures[i];
+            future.load(*timeline);
+            future.io.set_key(i == 0 ? 0xFF : u8(i - 1));
+            future.run_frames<Q>(1);
+        }));
+    }
+}
+
+CPU::Status CPU::status ()
+{
+    return current_status;
+}
+
+uint64_t CPU::hash ()
+{
+    // 64-bit hash of the whole machine state
+
+    resolve_flag();
+    u64 h = RAM.hash();
+    h = hash64(V.data(), V.size(), h);
+
+    h = hash64(RPL.data(), RPL.size(), h);
+    h = hash64(PATTERN.data(), PATTERN.size(), h);
+
+    u32 regs[] = {DT, ST, SP, I, PC, RNG, PITCH};
+    h = hash64(regs, sizeof(regs), h);
+
+    return io.display().hash(h);
+}
+
+void CPU::save (State &state)
+{
+    // Pending VF is settled so the snapshot needs no lazy flag state
+
+    resolve_flag();
+
+    state.DT = DT;
+    state.ST = ST;
+    state.PITCH = PITCH;
+    state.SP = SP;
+    state.I  = I;
+    state.PC = PC;
+    state.RNG = RNG;
+    state.V = V;
+    state.RPL = RPL;
+    state.PATTERN = PATTERN;
+    state.RAM = RAM;
+    state.display = io.display();
+
+    state.cycles = cycles;
+    state.ticks  = ticks;
+    state.status = current_status;
+    state.watchdog_hash = watchdog_hash;
+    state.sound = sound;
+}
+
+void CPU::load (const State &state)
+{
+    DT = state.DT;
+    ST = state.ST;
+    PITCH = state.PITCH;
+    SP = state.SP;
+    I  = state.I;
+    PC = state.PC;
+    RNG = state.RNG;
+    V = state.V;
+    RPL = state.RPL;
+    PATTERN = state.PATTERN;
+    RAM = state.RAM;
+    io.display() = state.display;
+
+    cycles = state.cycles;
+    ticks  = state.ticks;
+    current_status = state.status;
+    watchdog_hash = state.watchdog_hash;
+    sound = state.sound;
+    flag_op = Flag::none;
+}
+
+CPU::Branch CPU::fork ()
+{
+    // Headless copy of the running machine. RAM pages are shared, so the
+    // cost grows only with the pages either side writes afterwards.
+
+    CPU* child = nullptr;
+    {
+        lock_guard<mutex> lock(arena_mutex);
+        if (!arena.empty()) {
+            child = arena.back();
+            arena.pop_back();
+        }
+    }
+    if (!child)
+        child = new CPU(Mode::batch);
+
+    // The snapshot lets go of the pages once the child holds them, or the
+    // parent's next write to each would copy it for nobody
+    thread_local State state;
+    save(state);
+    child->load(state);
+    state.RAM = Memory();
+    child->quirks = quirks;
+    child->quirks_set = quirks_set;
+    child->program_end = program_end;
+    child->rom_size = rom_size;
+    child->idle_skip = idle_skip;
+    child->io.set_key(io.last_key());
+    child->code.set_tiers(code.tiers());
+    child->dispatch = dispatch;
+    child->hle.set_mode(hle.mode());
+
+    // A child from the arena still holds whatever its last owner set up:
+    // the profiles and stats it filled belong to that owner, and a branch
+    // neither runs ahead nor speculates
+    child->coverage = nullptr;
+    child->pairs = nullptr;
+    child->hle.reset();
+    child->code.reset_stats();
+    child->set_run_ahead(0);
+    child->set_speculative(false);
+    child->speculating = false;
+    if (child->code_dir != code_dir || child->rom_hash != rom_hash) {
+        child->code_dir = code_dir;
+        child->rom_hash = rom_hash;
+        child->code.use_cache(code_dir, rom_hash);
+    }
+
+    return Branch(child);
+}
+
+void CPU::Recycle::operator() (CPU* cpu) const
+{
+    // A dead branch keeps nothing of its timeline's pages
+    cpu->RAM = Memory();
+
+    lock_guard<mutex> lock(arena_mutex);
+    arena.push_back(cpu);
+}
+
+void CPU::set_key (uint8_t key)
+{
+    // Holds a key on a headless instance (0xFF releases it)
+
+    io.set_key(key);
+}
+
+void CPU::set_coverage (Coverage* map)
+{
+    // Marks executed addresses in map during advance(), nullptr to stop
+
+    coverage = map;
+}
+
+void CPU::set_pair_profile (OpPairs* pairs)
+{
+    // Counts consecutive operations into pairs during headless runs, which
+    // are then all interpreted. nullptr to stop.
+
+    this->pairs = pairs;
+}
+
+void CPU::seed (uint32_t value)
+{
+    // Restarts Cxnn's generator, which must never hold zero
+
+    RNG = value ? value : 1;
+}
+
+uint8_t CPU::peek (uint16_t addr)
+{
+    return RAM[addr];
+}
+
+Display& CPU::display ()
+{
+    return io.display();
+}
+
+void CPU::set_tiers (Code::Tiers tiers)
+{
+    // Promotion thresholds of the headless loops (see Code)
+
+    code.set_tiers(tiers);
+}
+
+void CPU::set_dispatch (Dispatch dispatch)
+{
+    this->dispatch = dispatch;
+}
+
+void CPU::set_code_cache (string dir)
+{
+    // Takes decoded blocks for the rom from, and saves them to, a cache
+    // file in dir (see Code). Empty turns it off.
+
+    code_dir = dir;
+    code.use_cache(dir, rom_hash);
+}
+
+void CPU::save_code ()
+{
+    // Adds the blocks decoded so far from the rom's bytes to its cache file
+
+    code.save();
+}
+
+Code::Stats CPU::code_stats ()
+{
+    return code.stats();
+}
+
+void CPU::set_hle (Hle::Mode mode)
+{
+    // Headless runs only: known subroutines run natively (see Hle), and
+    // with verify also as instructions on a fork, keeping the latter's
+    // result if the two differ
+
+    hle.set_mode(mode);
+}
+
+Hle::Stats CPU::hle_stats ()
+{
+    return hle.stats();
+}
+
+void CPU::reset (const State &pristine, uint32_t seed)
+{
+    // Back to a snapshot taken once after boot (open_rom, set_quirks) with
+    // a new RNG stream. Only RAM pages written since then change hands,
+    // everything else is a flat copy.
+
+    load(pristine);
+    this->seed(seed);
+    io.set_key(0xFF);
+}
+
+void CPU::watchdog ()
+{
+    // Marks the instance as hung when the whole machine state repeats with
+    // no timers running and no key held, since then nothing can change it
+
+    bool idle = DT == 0 && ST == 0 && io.last_key() == 0xFF;
+    auto state = idle ? hash() : 0;
+
+    if (idle && state == watchdog_hash)
+        current_status = Status::hung;
+    watchdog_hash = state;
+}
+
+CPU::u64 CPU::idle_loop (u8 dt, bool* reads_dt)
+{
+    // Returns the length of the loop starting at PC if, with the delay
+    // timer at the given value, it keeps jumping back to PC doing nothing
+    // but reading DT (first instruction only) and comparing. Such a loop
+    // spins identically until the next timer tick. Returns 0 otherwise.
+    // reads_dt, if given, is set when the loop starts with Fx07.
+
+    resolve_flag();
+    auto regs = V;
+    u16 pc = PC;
+
+    for (u64 length = 1; length <= 8 && pc < program_end; ++length)
+    {
+        u16 opcode = fetch(pc);
+        u8  x    = (opcode >> 8) & 0x0F;
+        u8  y    = (opcode >> 4) & 0x0F;
+        u8  n    =  opcode & 0x0F;
+        u8  byte =  opcode & 0xFF;
+
+        switch (opcode >> 12) {
+            case 0x1:
+                if ((opcode & 0x0FFF) != PC)
+                    return 0;
+                return length;
+            case 0x3:
+                if (fetch(pc + 2) == 0xF000) return 0;
+                pc += regs[x] == byte ? 4 : 2;
+                break;
+            case 0x4:
+                if (fetch(pc + 2) == 0xF000) return 0;
+                pc += regs[x] != byte ? 4 : 2;
+                break;
+            case 0x5:
+                if (n != 0x0 || fetch(pc + 2) == 0xF000) return 0;
+                pc += regs[x] == regs[y] ? 4 : 2;
+                break;
+            case 0x9:
+                if (n != 0x0 || fetch(pc + 2) == 0xF000) return 0;
+                pc += regs[x] != regs[y] ? 4 : 2;
+                break;
+            case 0xF:
+                if (byte != 0x07 || pc != PC) return 0;
+                if (reads_dt) *reads_dt = true;
+                regs[x] = dt;
+                pc += 2;
+                break;
+            default:
+                return 0;
+        }
+    }
+    return 0;
+}
+
+CPU::u64 CPU::skip_idle_loop (u64 budget)
+{
+    // Batch mode: skips whole iterations of an idle loop for as long as
+    // the delay timer keeps it spinning, short of the budget and of the
+    // next watchdog check, and returns the skipped cycles
+
+    if (!idle_skip || cycles % watchdog_period == 0)
+        return 0;
+
+    bool reads_dt = false;
+    auto length = idle_loop(DT, &reads_dt);
+    if (length == 0)
+        return 0;
+
+    u64 check = (cycles / watchdog_period + 1) * watchdog_period;
+    budget = min(budget, check - cycles);
+
+    // Lowest DT value that still spins the same way
+    u8 lowest = DT;
+    while (lowest > 0 && idle_loop(lowest - 1) == length)
+        --lowest;
+
+    auto elapsed = [this](u64 c) { return c * timer_rate / clock_rate; };
+
+    u64 iterations = budget / length;
+    if (lowest > 0 || idle_loop(0) != length) {
+        // The last skipped iteration must still read DT >= lowest
+        u64 limit = elapsed(cycles) + (DT - lowest) + 1;
+        u64 boundary = (limit * clock_rate + timer_rate - 1) / timer_rate;
+        iterations = min(iterations, (boundary - 1 - cycles) / length + 1);
+    }
+    if (iterations == 0)
+        return 0;
+
+    u64 end = cycles + iterations * length;
+    u64 last_read = elapsed(end - length) - elapsed(cycles);
+
+    // Only a loop that reads DT leaves it in a register (a bare 1nnn to
+    // itself, say, touches none)
+    if (reads_dt) {
+        u8 x = (fetch(PC) >> 8) & 0x0F;
+        V[x] = u8(DT > last_read ? DT - last_read : 0);
+    }
+    pass_time(end);
+
+    return iterations * length;
+}
+
+CPU::u64 CPU::skip_counting_loop (u64 budget)
+{
+    // Batch mode: skips whole iterations of a loop at PC that only adds
+    // constants to registers, then jumps back unless a comparison on them
+    // skips the jump (7x01 3xnn 1nnn, 7xFF 3x00 1nnn and the like). After
+    // k iterations every register has moved by k times its sum of adds,
+    // so the iteration that leaves is found without running any. Stops
+    // short of it, of the budget and of the next watchdog check, and
+    // returns the skipped cycles.
+
+    if (!idle_skip || cycles % watchdog_period == 0)
+        return 0;
+
+    arr<u8,16> added {}; // Per iteration
+    u8 last = 0;         // Register of the last add, whose carry VF keeps
+    u8 constant = 0;
+    u16 pc = PC;
+    Instr instr = decode(fetch(pc));
+    for (unsigned adds = 0; instr.op == Op::ADD_XB && instr.x != 0xF && adds < 8; ++adds) {
+        added[instr.x] += instr.byte();
+        last = instr.x;
+        constant = instr.byte();
+        pc += 2;
+        instr = decode(fetch(pc));
+    }
+
+    const Instr& test = instr;
+    Instr jump = decode(fetch(pc + 2));
+    bool pair = test.op == Op::SE_XY || test.op == Op::SNE_XY;
+    bool equal = test.op == Op::SE_XB || test.op == Op::SE_XY;
+    if (pc == PC || u32(pc) + 4 > program_end
+        || !(pair || test.op == Op::SE_XB || test.op == Op::SNE_XB)
+        || test.x == 0xF || (pair && test.y == 0xF)
+        || jump.op != Op::JP || jump.addr != PC)
+        return 0;
+
+    // Registers repeat every 256 iterations at most
+    auto leaves = [&](u64 k) {
+        u8 a = u8(V[test.x] + k * added[test.x]);
+        u8 b = pair ? u8(V[test.y] + k * added[test.y]) : test.byte();
+        return (a == b) == equal;
+    };
+    u64 exit = 0;
+    for (u64 k = 1; k <= 256 && !exit; ++k)
+        if (leaves(k))
+            exit = k;
+
+    u64 length = (pc - PC) / 2 + 2;
+    u64 check = (cycles / watchdog_period + 1) * watchdog_period;
+    u64 iterations = min(budget, check - cycles) / length;
+    if (exit)
+        iterations = min(iterations, exit - 1);
+    if (iterations == 0)
+        return 0;
+
+    for (unsigned i=0; i<16; ++i)
+        V[i] = u8(V[i] + iterations * added[i]);
+    defer_flag(Flag::carry, u8(V[last] - constant), constant, V[last]);
+    pass_time(cycles + iterations * length);
+
+    return iterations * length;
+}
+
+template <typename Q>
+CPU::u64 CPU::call_routine (u64 budget)
+{
+    // Batch mode, right after a CALL: runs the subroutine at PC natively
+    // through its RET if it is a known one. Like the loop skips it stops
+    // short of the budget and of the next watchdog check. Runs that record
+    // coverage or operation pairs see every instruction. Returns the
+    // instructions it stood for, 0 if they are left to run.
+
+    if (hle.mode() == Hle::Mode::off || coverage || pairs || cycles % watchdog_period == 0)
+        return 0;
+
+    const Match* match = hle.find(RAM, PC, program_end);
+    u64 length = match ? routine_length<Q>(*match) : 0;
+    u64 check = (cycles / watchdog_period + 1) * watchdog_period;
+    if (length == 0 || length > budget || length > check - cycles)
+        return 0;
+
+    Branch guest = hle.mode() == Hle::Mode::verify ? fork() : Branch();
+    run_routine<Q>(*match, length);
+    pass_time(cycles + length);
+
+    bool same = true;
+    if (guest) {
+        guest->hle.set_mode(Hle::Mode::off);
+        guest->run(length);
+        same = guest->hash() == hash() && guest->cycles == cycles;
+        if (!same) {
+            // The instructions are right by definition
+            thread_local State state;
+            guest->save(state);
+            load(state);
+            state.RAM = Memory();
+        }
+    }
+    hle.account(length, !same);
+    return length;
+}
+
+template <typename Q>
+CPU::u64 CPU::routine_length (const Match& match)
+{
+    // Instructions from the routine's start through its RET, 0 if it never
+    // gets there or would write over its own code on the way
+
+    // Fx33's three digits are the only bytes the score routine writes
+    if (match.routine == Routine::score) {
+        for (unsigned j=0; j<3; ++j)
+            if (u16(I + j - match.start) < match.length)
+                return 0;
+        return 11;
+    }
+
+    u8 x = u8(match.field('x')), c = u8(match.field('c'));
+    u8 k = u8(match.field('k')), e = u8(match.field('e'));
+    bool copy = match.routine == Routine::copy;
+    bool step = match.field('r') != 0xFFFF;
+
+    // The counter only moves by its add, so it repeats within 256 times
+    u64 times = 0;
+    for (u64 i = 1; i <= 256 && !times; ++i)
+        if (u8(V[c] + i * k) == e)
+            times = i;
+    if (!times)
+        return 0;
+
+    u16 at = I;
+    u16 advance = Q::advance_i ? x + 1 : 0;
+    for (u64 i=0; i<times; ++i) {
+        if (copy)
+            at = u16(at + advance + V[match.field('a')]);
+        for (unsigned j=0; j<=x; ++j)
+            if (u16(at + j - match.start) < match.length)
+                return 0;
+        at = u16(at + advance + (copy ? V[match.field('b')] : step ? V[match.field('r')] : 0));
+    }
+
+    // Every time round runs all but one of its instructions: the jump back,
+    // or on the last one the RET
+    return times * (match.length / 2 - 1);
+}
+
+template <typename Q>
+void CPU::run_routine (const Match& match, u64 length)
+{
+    // The routine's effects in the order its instructions have them, then
+    // its RET
+
+    if (match.routine == Routine::score) {
+        u8 s = u8(match.field('s')), a = u8(match.field('a'));
+        u8 b = u8(match.field('b')), n = u8(match.field('n'));
+        u8 k = u8(match.field('k'));
+
+        LD(I, BCD(V[s]));
+        LD<Q::advance_i>(RNGV(0, 2), I);
+        for (u8 digit=0; digit<3; ++digit) {
+            if (digit > 0)
+                ADD(V[a], k);
+            LD(I, FONT(V[digit]));
+            DRW<Q>(V[a], V[b], n);
+        }
+    }
+    else {
+        u8 x = u8(match.field('x')), c = u8(match.field('c'));
+        u8 k = u8(match.field('k'));
+        bool copy = match.routine == Routine::copy;
+        bool step = match.field('r') != 0xFFFF;
+        u16 advance = Q::advance_i ? x + 1 : 0;
+
+        for (u64 times = length / (match.length / 2 - 1); times > 0; --times) {
+            if (copy) {
+                for (unsigned j=0; j<=x; ++j)
+                    V[j] = RAM[u16(I + j)];
+                I = u16(I + advance + V[match.field('a')]);
+            }
+            for (unsigned j=0; j<=x; ++j)
+                RAM.write(u16(I + j), V[j]);
+            I = u16(I + advance);
+            if (copy)
+                I = u16(I + V[match.field('b')]);
+            else if (step)
+                I = u16(I + V[match.field('r')]);
+            ADD(V[c], k);
+        }
     }
+
+    RET();
+}
+
+void CPU::pass_time (u64 end)
+{
+    // Moves virtual time on to cycle end without running anything: the
+    // timers tick as they would have, and the beeper stops on the tick
+    // that takes ST to zero
+
+    auto elapsed = [this](u64 c) { return c * timer_rate / clock_rate; };
+    u64 passed = elapsed(end) - elapsed(cycles);
+
+    if (ST > 0 && ST <= passed) {
+        u64 tick = ticks + ST;
+        post_sound(false, (tick * clock_rate + timer_rate - 1) / timer_rate);
+    }
+
+    DT = u8(DT > passed ? DT - passed : 0);
+    ST = u8(ST > passed ? ST - passed : 0);
+    ticks += passed;
+    cycles = end;
+}
+
+void CPU::sleep_idle_loop ()
+{
+    // Interactive mode: sleeps through an idle loop until the next tick
+    // (the audio clock already sleeps whenever the emulation is ahead)
+
+    if (audio_clock || !idle_skip || idle_loop(DT) == 0)
+        return;
+
+    Trace::Zone zone("idle");
+    auto remaining = 1000000/60 - delay_timer.getTime();
+    if (remaining < 2000)
+        return;
+
+    SDL_Delay(Uint32(remaining / 1000));
+    cycles += u64(remaining / 1000) * clock_rate / 1000;
+    cpu_timer.start();
 }
 
 u16 CPU::fetch ()
 {
-    u16 opcode = u16(RAM[PC] << 8) | RAM[PC+1];
+    return fetch(PC);
+}
+
+u16 CPU::fetch (u16 addr)
+{
+    u16 opcode = u16(RAM[addr] << 8) | RAM[u16(addr + 1)];
     return opcode;
 }
 
+template <typename Q>
 void CPU::execute (u16 opcode)
 {
-    u8  x    = (opcode >> 8) & 0x0F;
-    u8  y    = (opcode >> 4) & 0x0F;
-    u8  n    =  opcode & 0x0F;
-    u8  byte =  opcode & 0xFF;
-    u16 addr =  opcode & 0x0FFF;
+    execute<Q>(decode(opcode));
+}
+
+template <typename Q>
+void CPU::execute (const Instr& instr)
+{
+    #define CASE(op) case Op::op: return perform<Q, Op::op>(instr);
+
+    switch (instr.op)
+    {
+        CASE(CLS)     CASE(RET)     CASE(SCD)     CASE(SCU)     CASE(SCR)
+        CASE(SCL)     CASE(EXIT)    CASE(LOW)     CASE(HIGH)    CASE(SYS)
+        CASE(JP)      CASE(CALL)    CASE(SE_XB)   CASE(SNE_XB)  CASE(SE_XY)
+        CASE(SAVE_XY) CASE(LOAD_XY) CASE(LD_XB)   CASE(ADD_XB)  CASE(LD_XY)
+        CASE(OR)      CASE(AND)     CASE(XOR)     CASE(ADD_XY)  CASE(SUB)
+        CASE(SHR)     CASE(SUBN)    CASE(SHL)     CASE(SNE_XY)  CASE(LD_I)
+        CASE(JP_V)    CASE(RND)     CASE(DRW)     CASE(SKP)     CASE(SKNP)
+        CASE(LONG)    CASE(PLANE)   CASE(AUDIO)   CASE(LD_X_DT) CASE(LD_X_K)
+        CASE(LD_DT_X) CASE(LD_ST_X) CASE(ADD_I_X) CASE(FONT)    CASE(HFONT)
+        CASE(BCD)     CASE(PITCH)   CASE(SAVE)    CASE(LOAD)    CASE(SAVE_FLAGS)
+        CASE(LOAD_FLAGS) CASE(NONE)
+    }
+    #undef CASE
+}
+
+template <typename Q, Op op>
+void CPU::perform (const Instr& instr)
+{
+    [[maybe_unused]] u8  x    = instr.x;
+    [[maybe_unused]] u8  y    = instr.y;
+    [[maybe_unused]] u8  n    = instr.n;
+    [[maybe_unused]] u8  byte = instr.byte();
+    [[maybe_unused]] u16 addr = instr.addr;
+
+    // Advance first, so that any jump (even to itself) sticks
+    PC += 2;
 
-    auto last_PC = PC;
+    // VF is produced lazily, settle it for any instruction that names it
+    if (x == 0xF || y == 0xF)
+        resolve_flag();
 
-    #define SWITCH(expr)
-    #define CASE(expr) if (matches (opcode, expr))
+    #define CASE(name) if constexpr (op == Op::name)
     #define BREAK else
+    #define SCHIP(expr) { if constexpr (Q::superchip) expr; }
+    #define XOCHIP(expr) { if constexpr (Q::xochip) expr; }
+
+    CASE(CLS)        CLS<Q> ();             BREAK
+    CASE(RET)        RET  ();               BREAK
+    CASE(SCD)        SCHIP(SCD  (n))        BREAK
+    CASE(SCU)        XOCHIP(SCU (n))        BREAK
+    CASE(SCR)        SCHIP(SCR  ())         BREAK
+    CASE(SCL)        SCHIP(SCL  ())         BREAK
+    CASE(EXIT)       SCHIP(EXIT ())         BREAK
+    CASE(LOW)        SCHIP(LOW  ())         BREAK
+    CASE(HIGH)       SCHIP(HIGH ())         BREAK
+    CASE(SYS)        SYS  (addr);           BREAK
+    CASE(JP)         JP   (addr);           BREAK
+    CASE(CALL)       CALL (addr);           BREAK
+    CASE(SE_XB)      SE<Q::xochip>  (V[x], byte); BREAK
+    CASE(SNE_XB)     SNE<Q::xochip> (V[x], byte); BREAK
+    CASE(SE_XY)      SE<Q::xochip>  (V[x], V[y]); BREAK
+    CASE(SAVE_XY)    XOCHIP(LD<false> (I, RNGV(x,y))) BREAK
+    CASE(LOAD_XY)    XOCHIP(LD<false> (RNGV(x,y), I)) BREAK
+    CASE(LD_XB)      LD   (V[x], byte);     BREAK
+    CASE(ADD_XB)     ADD  (V[x], byte);     BREAK
+    CASE(LD_XY)      LD   (V[x], V[y]);     BREAK
+    CASE(OR)         OR<Q::logic_vf>  (V[x], V[y]); BREAK
+    CASE(AND)        AND<Q::logic_vf> (V[x], V[y]); BREAK
+    CASE(XOR)        XOR<Q::logic_vf> (V[x], V[y]); BREAK
+    CASE(ADD_XY)     ADD  (V[x], V[y]);     BREAK
+    CASE(SUB)        SUB  (V[x], V[y]);     BREAK
+    CASE(SHR)        SHR  (V[x], V[Q::shift_vy ? y : x]); BREAK
+    CASE(SUBN)       SUBN (V[x], V[y]);     BREAK
+    CASE(SHL)        SHL  (V[x], V[Q::shift_vy ? y : x]); BREAK
+    CASE(SNE_XY)     SNE<Q::xochip> (V[x], V[y]); BREAK
+    CASE(LD_I)       LD   (I, addr);        BREAK
+    CASE(JP_V)       JP   (V[Q::jump_vx ? x : 0], addr); BREAK
+    CASE(RND)        RND  (V[x], byte);     BREAK
+    CASE(DRW)        DRW<Q> (V[x], V[y], n); BREAK
+    CASE(SKP)        SKP<Q::xochip>  (V[x]); BREAK
+    CASE(SKNP)       SKNP<Q::xochip> (V[x]); BREAK
+    CASE(LONG)       XOCHIP(LONG (I))       BREAK
+    CASE(PLANE)      XOCHIP(PLANE (x))      BREAK
+    CASE(AUDIO)      XOCHIP({ LD (PATTERN, I); post_voice(cycles); }) BREAK
+    CASE(LD_X_DT)    LD   (V[x], DT);       BREAK
+    CASE(LD_X_K)     LD   (V[x], KEY());    BREAK
+    CASE(LD_DT_X)    LD   (DT, V[x]);       BREAK
+    CASE(LD_ST_X)    LD   (ST, V[x]);       BREAK
+    CASE(ADD_I_X)    ADD  (I, V[x]);        BREAK
+    CASE(FONT)       LD   (I, FONT(V[x]));  BREAK
+    CASE(HFONT)      SCHIP(LD (I, HFONT(V[x]))) BREAK
+    CASE(BCD)        LD   (I, BCD(V[x]));   BREAK
+    CASE(PITCH)      XOCHIP({ LD (PITCH, V[x]); post_voice(cycles); }) BREAK
+    CASE(SAVE)       LD<Q::advance_i> (I, RNGV(0,x)); BREAK
+    CASE(LOAD)       LD<Q::advance_i> (RNGV(0,x), I); BREAK
+    CASE(SAVE_FLAGS) SCHIP(LD (RPL, RNGV(0,x))) BREAK
+    CASE(LOAD_FLAGS) SCHIP(LD (RNGV(0,x), RPL))
 
-    SWITCH(opcode)
-    {
-        CASE("00E0") CLS  ();               BREAK
-        CASE("00EE") RET  ();               BREAK
-        CASE("0nnn") SYS  (addr);           BREAK
-        CASE("1nnn") JP   (addr);           BREAK
-        CASE("2nnn") CALL (addr);           BREAK
-        CASE("3xnn") SE   (V[x], byte);     BREAK
-        CASE("4xnn") SNE  (V[x], byte);     BREAK
-        CASE("5xy0") SE   (V[x], V[y]);     BREAK
-        CASE("6xnn") LD   (V[x], byte);     BREAK
-        CASE("7xnn") ADD  (V[x], byte);     BREAK
-        CASE("8xy0") LD   (V[x], V[y]);     BREAK
-        CASE("8xy1") OR   (V[x], V[y]);     BREAK
-        CASE("8xy2") AND  (V[x], V[y]);     BREAK
-        CASE("8xy3") XOR  (V[x], V[y]);     BREAK
-        CASE("8xy4") ADD  (V[x], V[y]);     BREAK
-        CASE("8xy5") SUB  (V[x], V[y]);     BREAK
-        CASE("8xy6") SHR  (V[x]);           BREAK
-        CASE("8xy7") SUBN (V[x], V[y]);     BREAK
-        CASE("8xyE") SHL  (V[x]);           BREAK
-        CASE("9xy0") SNE  (V[x], V[y]);     BREAK
-        CASE("Annn") LD   (I, addr);        BREAK
-        CASE("Bnnn") JP   (V[0], addr);     BREAK
-        CASE("Cxnn") RND  (V[x], byte);     BREAK
-        CASE("Dxyn") DRW  (V[x], V[y], n);  BREAK
-        CASE("Ex9E") SKP  (V[x]);           BREAK
-        CASE("ExA1") SKNP (V[x]);           BREAK
-        CASE("Fx07") LD   (V[x], DT);       BREAK
-        CASE("Fx0A") LD   (V[x], KEY());    BREAK
-        CASE("Fx15") LD   (DT, V[x]);       BREAK
-        CASE("Fx18") LD   (ST, V[x]);       BREAK
-        CASE("Fx1E") ADD  (I, V[x]);        BREAK
-        CASE("Fx29") LD   (I, FONT(V[x]));  BREAK
-        CASE("Fx33") LD   (I, BCD(V[x]));   BREAK
-        CASE("Fx55") LD   (I, RNGV(0,x));   BREAK
-        CASE("Fx65") LD   (RNGV(0,x), I);
-    }
-    #undef SWITCH
     #undef CASE
     #undef BREAK
+    #undef SCHIP
+    #undef XOCHIP
+}
+
+template <typename Q, Op op, Op... rest>
+unsigned CPU::step (CPU& cpu, const Instr* instr)
+{
+    // Runs op, then each of the rest while control falls through to it
+
+    u16 next = u16(cpu.PC + instr->size());
+    cpu.perform<Q, op>(*instr);
 
-    if (last_PC == PC)
-        PC += 2;
+    if constexpr (sizeof...(rest) > 0)
+        if (cpu.PC == next)
+            return 1 + step<Q, rest...>(cpu, instr + 1);
+    return 1;
+}
+
+template <typename Q>
+const Handlers* CPU::handlers ()
+{
+    // Tier 2 handlers for this profile, indexed by operation, and its
+    // superinstructions. A fused operation other than the last must not
+    // touch the timers or wait for a key, since the loops tick the timers
+    // once the whole superinstruction has run. The set comes from the
+    // pair counts of CHIP-8-bench --pairs.
+
+    #define STEP(op) &CPU::step<Q, Op::op>,
+
+    static const Handler single[] = {
+        STEP(CLS)     STEP(RET)     STEP(SCD)     STEP(SCU)     STEP(SCR)
+        STEP(SCL)     STEP(EXIT)    STEP(LOW)     STEP(HIGH)    STEP(SYS)
+        STEP(JP)      STEP(CALL)    STEP(SE_XB)   STEP(SNE_XB)  STEP(SE_XY)
+        STEP(SAVE_XY) STEP(LOAD_XY) STEP(LD_XB)   STEP(ADD_XB)  STEP(LD_XY)
+        STEP(OR)      STEP(AND)     STEP(XOR)     STEP(ADD_XY)  STEP(SUB)
+        STEP(SHR)     STEP(SUBN)    STEP(SHL)     STEP(SNE_XY)  STEP(LD_I)
+        STEP(JP_V)    STEP(RND)     STEP(DRW)     STEP(SKP)     STEP(SKNP)
+        STEP(LONG)    STEP(PLANE)   STEP(AUDIO)   STEP(LD_X_DT) STEP(LD_X_K)
+        STEP(LD_DT_X) STEP(LD_ST_X) STEP(ADD_I_X) STEP(FONT)    STEP(HFONT)
+        STEP(BCD)     STEP(PITCH)   STEP(SAVE)    STEP(LOAD)    STEP(SAVE_FLAGS)
+        STEP(LOAD_FLAGS) STEP(NONE)
+    };
+    static_assert(sizeof(single) / sizeof(single[0]) == op_count,
+                  "One handler per operation");
+    #undef STEP
+
+    #define FUSE2(a, b)    {{Op::a, Op::b}, 2, &CPU::step<Q, Op::a, Op::b>},
+    #define FUSE3(a, b, c) {{Op::a, Op::b, Op::c}, 3, &CPU::step<Q, Op::a, Op::b, Op::c>},
+
+    static const Fusion fusions[] = {
+        FUSE3(ADD_XB, SE_XB,  JP)      // Counting loops
+        FUSE3(ADD_XB, SNE_XB, JP)
+        FUSE2(SE_XB,  JP)
+        FUSE2(SNE_XB, JP)
+        FUSE2(ADD_XB, SE_XB)
+        FUSE2(ADD_XB, SNE_XB)
+        FUSE2(LD_I,   DRW)             // Sprites
+        FUSE2(ADD_XB, DRW)
+        FUSE2(DRW,    ADD_XB)
+        FUSE2(LD_I,   SAVE)            // Memory through I
+        FUSE2(LD_I,   LOAD)
+        FUSE2(LD_I,   BCD)
+        FUSE2(LD_XB,  LD_XB)           // Arithmetic
+        FUSE2(ADD_XY, SUB)
+        FUSE2(ADD_XB, ADD_XY)
+    };
+    #undef FUSE2
+    #undef FUSE3
+
+    static const Handlers table = {single, fusions, sizeof(fusions) / sizeof(fusions[0]),
+                                   {Q::logic_vf, Q::shift_vy}};
+    return &table;
+}
+
+void CPU::defer_flag (Flag op, u8 a, u8 b, const u8 &target)
+{
+    // Records a flag-producing operation instead of writing VF. If the
+    // target register is VF itself, the flag has to be there right away
+    // since the operation reads it back as its operand.
+
+    flag_op = op;
+    flag_a = a;
+    flag_b = b;
+
+    if (&target == &V[0xF])
+        resolve_flag();
+}
+
+void CPU::clear_flag ()
+{
+    // Sets VF to zero, dropping any pending flag
+
+    flag_op = Flag::none;
+    V[0xF] = 0x00;
+}
+
+void CPU::resolve_flag ()
+{
+    // Writes the VF value of the last flag-producing operation
+
+    switch (flag_op) {
+        case Flag::none:      return;
+        case Flag::carry:     V[0xF] = flag_a + flag_b > 0xFF; break;
+        case Flag::no_borrow: V[0xF] = flag_a >= flag_b;       break;
+        case Flag::msb:       V[0xF] = flag_a >> 7;            break;
+        case Flag::lsb:       V[0xF] = flag_a & 0x01;          break;
+    }
+    flag_op = Flag::none;
 }
 
 void CPU::update_timers ()
 {
-    while (cpu_timer.getTime() < 1000000/500) {
-        if (cpu_timer.getTime() < 1000)
-            SDL_Delay(1);
+    if (audio_clock) {
+        // Virtual time, held back to what the device has played
+        tick_timers();
+        Trace::Zone zone("sleep");
+        audio.pace(cycles * Audio::sample_rate / clock_rate);
+        return;
+    }
+
+    {
+        Trace::Zone zone("sleep");
+        while (cpu_timer.getTime() < 1000000/500) {
+            if (cpu_timer.getTime() < 1000)
+                SDL_Delay(1);
+        }
     }
     cpu_timer.start();
+    ++cycles;
 
     if (delay_timer.getTime() > 1000000/60) {
         if (DT > 0) --DT;
         if (ST > 0) --ST;
         delay_timer.start();
+        Trace::frame(++ticks);
     }
+
+    if ((ST != 0) != sound)
+        post_sound(ST != 0, cycles);
+}
+
+void CPU::tick_timers ()
+{
+    // Virtual time: timers tick every clock_rate/timer_rate instructions
+
+    ++cycles;
+    if (cycles * timer_rate >= (ticks + 1) * clock_rate) {
+        ++ticks;
+        if (DT > 0) --DT;
+        if (ST > 0) --ST;
+        if (!speculating)
+            Trace::frame(ticks);
+    }
+
+    if ((ST != 0) != sound)
+        post_sound(ST != 0, cycles);
+}
+
+void CPU::post_sound (bool on, u64 cycle)
+{
+    // Hands a beeper change to the audio backend, timed in samples
+
+    sound = on;
+    if (!speculating)
+        audio.beep(on, cycle * Audio::sample_rate / clock_rate);
+}
+
+void CPU::post_voice (u64 cycle)
+{
+    // Hands the XO-CHIP pattern and pitch to the audio backend, which
+    // plays them instead of its square tone from then on
+
+    if (!speculating)
+        audio.voice(PATTERN, PITCH, cycle * Audio::sample_rate / clock_rate);
 }
 
+template <typename Q>
 void CPU::CLS ()
 {
-    // Clears screen
+    // Clears screen (the selected planes on XO-CHIP)
 
     io.clear();
-    for (u16 addr = 0x0F00; addr < 0x0FFF; ++addr)
-        RAM[addr] = 0x00;
+    if constexpr (!Q::xochip)
+        for (u16 addr = 0x0F00; addr < 0x0FFF; ++addr)
+            RAM.write(addr, 0x00);
 }
 
 void CPU::RET ()
@@ -250,7 +1575,7 @@ void CPU::CALL (u16 addr)
 {
     // Calls subroutine
 
-    stack_push(PC + 2);
+    stack_push(PC);
     JP(addr);
 }
 
@@ -268,17 +1593,84 @@ void CPU::JP (u8 offset, u16 addr)
     PC = addr + offset;
 }
 
+template <typename Q>
 void CPU::DRW (u8 x, u8 y, u8 n)
 {
-    // Draws sprite to screen
+    // Draws sprite to screen (16x16 when n is 0 on SUPER-CHIP)
 
-    V[0xF] = 0x00; // Flag
+    Trace::Zone zone("DRW");
+    clear_flag();
+
+    auto &display = io.display();
+    u8 planes = (display.selected() & 0x01) + (display.selected() >> 1);
+
+    bool wide = Q::superchip && n == 0;
+    arr<u8,64> sprite;
+    for (u16 i=0; i<(wide ? 32 : n) * planes; ++i)
+        sprite[i] = RAM[(I + i) & (Q::xochip ? 0xFFFF : 0x0FFF)];
+
+    bool collision = wide ? display.draw16<Q::clip>(sprite.data(), x, y)
+                          : display.draw<Q::clip>(sprite.data(), n, x, y);
+    if (collision)
+        V[0xF] = 0x01;
 
-    for (u8 row=0; row<n; ++row) {
-        u8 writer = RAM[I + row];
-        if (io.draw(to_sprite(writer), x, y + row))
-            V[0xF] = 0x01;
-    }
+    io.refresh_display();
+}
+
+void CPU::EXIT ()
+{
+    // Stops the interpreter
+
+    if (mode == Mode::interactive && !speculating)
+        exit(EXIT_SUCCESS);
+    current_status = Status::exited;
+}
+
+void CPU::HIGH ()
+{
+    // Switches to 128x64 mode
+
+    io.display().set_hires(true);
+    io.refresh_display();
+}
+
+void CPU::LOW ()
+{
+    // Switches to 64x32 mode
+
+    io.display().set_hires(false);
+    io.refresh_display();
+}
+
+void CPU::SCD (u8 n)
+{
+    // Scrolls display down N lines
+
+    io.display().scroll_down(n);
+    io.refresh_display();
+}
+
+void CPU::SCU (u8 n)
+{
+    // Scrolls display up N lines
+
+    io.display().scroll_up(n);
+    io.refresh_display();
+}
+
+void CPU::SCL ()
+{
+    // Scrolls display left 4 pixels
+
+    io.display().scroll_left(4);
+    io.refresh_display();
+}
+
+void CPU::SCR ()
+{
+    // Scrolls display right 4 pixels
+
+    io.display().scroll_right(4);
     io.refresh_display();
 }
 
@@ -296,12 +1688,16 @@ void CPU::LD (u8 &a, u8 b)
     a = b;
 }
 
-void CPU::LD (u16 addr, vec<u8*> range)
+template <bool advance>
+void CPU::LD (u16 &addr, vec<u8*> range)
 {
-    // Loads values to multiple addresses
+    // Loads values to multiple addresses (and optionally moves past them)
 
     for (u16 i=0; i<range.size(); ++i)
-        RAM[addr + i] = *range[i];
+        RAM.write(u16(addr + i), *range[i]);
+
+    if (advance)
+        addr += range.size();
 }
 
 void CPU::LD (u16 addr, vec<u8> range)
@@ -309,15 +1705,58 @@ void CPU::LD (u16 addr, vec<u8> range)
     // Loads values to multiple addresses
 
     for (u16 i=0; i<range.size(); ++i)
-        RAM[addr + i] = range[i];
+        RAM.write(u16(addr + i), range[i]);
 }
 
-void CPU::LD (vec<u8*> range, u16 addr)
+void CPU::LD (arr<u8,16> &flags, vec<u8*> range)
 {
-    // Loads values to multiple addresses
+    // Saves registers into the user flags
+
+    for (u16 i=0; i<range.size() && i<flags.size(); ++i)
+        flags[i] = *range[i];
+}
+
+void CPU::LD (vec<u8*> range, const arr<u8,16> &flags)
+{
+    // Restores registers from the user flags
+
+    for (u16 i=0; i<range.size() && i<flags.size(); ++i)
+        *range[i] = flags[i];
+}
+
+void CPU::LD (arr<u8,16> &pattern, u16 addr)
+{
+    // Loads the audio pattern buffer
+
+    for (u16 i=0; i<pattern.size(); ++i)
+        pattern[i] = RAM[u16(addr + i)];
+}
+
+void CPU::LONG (u16 &a)
+{
+    // Loads the 16-bit word that follows the instruction
+
+    a = fetch();
+    JP(PC + 2);
+}
+
+void CPU::PLANE (u8 mask)
+{
+    // Selects the planes that drawing, scrolling and clearing act on
+
+    io.display().select(mask);
+}
+
+template <bool advance>
+void CPU::LD (vec<u8*> range, u16 &addr)
+{
+    // Loads values to multiple addresses (and optionally moves past them)
 
     for (u16 i=0; i<range.size(); ++i)
-        *range[i] = RAM[addr + i];
+        *range[i] = RAM[u16(addr + i)];
+
+    if (advance)
+        addr += range.size();
 }
 
 void CPU::LD (vec<u8> range, u16 addr)
@@ -325,7 +1764,7 @@ void CPU::LD (vec<u8> range, u16 addr)
     // Loads values to multiple addresses
 
     for (u16 i=0; i<range.size(); ++i)
-        range[i] = RAM[addr + i];
+        range[i] = RAM[u16(addr + i)];
 }
 
 void CPU::ADD (u16 &a, u16 b)
@@ -339,10 +1778,7 @@ void CPU::ADD (u8 &a, u8 b)
 {
     // Adds two values and stores carry in VF
 
-    if (a + b > 0xFF)
-        V[0xF] = 0x01;
-    else
-        V[0xF] = 0x00;
+    defer_flag(Flag::carry, a, b, a);
 
     a = (u16(a) + u16(b)) & 0x00FF;
 }
@@ -351,10 +1787,7 @@ void CPU::SUB (u8 &a, u8 b)
 {
     // Subtracts two values and sets not-borrow flag (VF)
 
-    if (a >= b)
-        V[0xF] = 0x01;
-    else
-        V[0xF] = 0x00;
+    defer_flag(Flag::no_borrow, a, b, a);
 
     a -= b;
 }
@@ -363,90 +1796,109 @@ void CPU::SUBN (u8 &a, u8 b)
 {
     // Subtracts two values and sets not-borrow flag (VF)
 
-    if (b >= a)
-        V[0xF] = 0x01;
-    else
-        V[0xF] = 0x00;
+    defer_flag(Flag::no_borrow, b, a, a);
 
     a = b - a;
 }
 
+template <bool reset_vf>
 void CPU::OR (u8 &a, u8 b)
 {
-    // Boolean operator OR
+    // Boolean operator OR (and optionally clears VF)
 
     a |= b;
+    if (reset_vf)
+        clear_flag();
 }
 
+template <bool reset_vf>
 void CPU::AND (u8 &a, u8 b)
 {
-    // Boolean operator AND
+    // Boolean operator AND (and optionally clears VF)
 
     a &= b;
+    if (reset_vf)
+        clear_flag();
 }
 
+template <bool reset_vf>
 void CPU::XOR (u8 &a, u8 b)
 {
-    // Boolean operator XOR
+    // Boolean operator XOR (and optionally clears VF)
 
     a ^= b;
+    if (reset_vf)
+        clear_flag();
+}
+
+template <bool wide>
+void CPU::SKIP ()
+{
+    // Skips next instruction (both words of an XO-CHIP long load if wide)
+
+    JP(PC + (wide && fetch() == 0xF000 ? 4 : 2));
 }
 
+template <bool wide>
 void CPU::SE (u8 a, u8 b)
 {
     // Skips instruction if A equals B
 
     if (a == b)
-        JP(PC + 4);
+        SKIP<wide>();
 }
 
+template <bool wide>
 void CPU::SNE (u8 a, u8 b)
 {
     // Skips instruction if A doesn't equal B
 
     if (a != b)
-        JP(PC + 4);
+        SKIP<wide>();
 }
 
-void CPU::SHL (u8 &val)
+void CPU::SHL (u8 &a, const u8 &b)
 {
-    // Shifts left by 1 bit and saves the lost bit in VF
+    // Shifts B left by 1 bit into A and saves the lost bit in VF
 
-    V[0xF] = val >> 7;
-    val &= 0x7F;
-    val <<= 1;
+    defer_flag(Flag::msb, b, 0, a);
+    a = u8(b << 1);
 }
 
-void CPU::SHR (u8 &val)
+void CPU::SHR (u8 &a, const u8 &b)
 {
-    // Shifts right by 1 bit and saves the lost bit in VF
+    // Shifts B right by 1 bit into A and saves the lost bit in VF
 
-    V[0xF] = val & 0x01;
-    val >>= 1;
+    defer_flag(Flag::lsb, b, 0, a);
+    a = b >> 1;
 }
 
 void CPU::RND (u8 &a, u8 b)
 {
     // Generates a random number (0-255) and applies AND operator
 
-    srand(unsigned(time(nullptr)));
-    a = u8(rand() % 256) & b;
+    RNG ^= RNG << 13;
+    RNG ^= RNG >> 17;
+    RNG ^= RNG << 5;
+    a = u8(RNG >> 24) & b;
 }
 
+template <bool wide>
 void CPU::SKP (u8 key)
 {
     // Skips instruction if key is pressed
 
     if (key == io.last_key())
-        JP(PC + 4);
+        SKIP<wide>();
 }
 
+template <bool wide>
 void CPU::SKNP (u8 key)
 {
     // Skips instruction if key isn't pressed
 
     if (key != io.last_key())
-        JP(PC + 4);
+        SKIP<wide>();
 }
 
 CPU::vec<u8> CPU::BCD (u8 bin)
@@ -473,6 +1925,13 @@ u16 CPU::FONT (u8 digit)
     return address;
 }
 
+u16 CPU::HFONT (u8 digit)
+{
+    // Returns the address of a given digit's 8x10 font
+
+    return u16((digit % 10) * 10);
+}
+
 u8 CPU::KEY ()
 {
     // Waits for SDL to get a key event and returns the key
@@ -480,13 +1939,14 @@ u8 CPU::KEY ()
     return io.wait_key();
 }
 
-CPU::vec<u8*> CPU::RNGV (u8 lower_bound, u8 upper_bound)
+CPU::vec<u8*> CPU::RNGV (u8 first, u8 last)
 {
-    // Returns the range between Va and Vb as a vector
+    // Returns the range from Va to Vb (in either direction) as a vector
 
-    vec<u8*> range(upper_bound - lower_bound + 1);
-    for (u8 i=lower_bound; i<=upper_bound; ++i)
-        range[i] = &V[i];
+    bool up = first <= last;
+    vec<u8*> range((up ? last - first : first - last) + 1);
+    for (u8 i=0; i<range.size(); ++i)
+        range[i] = &V[up ? first + i : first - i];
 
     return range;
 }
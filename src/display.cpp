@@ -0,0 +1,399 @@
+#include <CHIP-8/display.h>
+#include <CHIP-8/hash.h>
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// 128-bit shifts over a (left, right) pair, left being the high half
+
+inline void shift_left (uint64_t &left, uint64_t &right, unsigned n)
+{
+    if (n == 0)
+        return;
+    if (n >= 64) {
+        left = n < 128 ? right << (n - 64) : 0;
+        right = 0;
+    } else {
+        left = (left << n) | (right >> (64 - n));
+        right <<= n;
+    }
+}
+
+inline void shift_right (uint64_t &left, uint64_t &right, unsigned n)
+{
+    if (n == 0)
+        return;
+    if (n >= 64) {
+        right = n < 128 ? left >> (n - 64) : 0;
+        left = 0;
+    } else {
+        right = (right >> n) | (left << (64 - n));
+        left >>= n;
+    }
+}
+
+// Doubles every bit of a 32-pixel run, keeping the first pixel on top
+inline uint64_t spread (uint32_t bits)
+{
+    uint64_t v = bits;
+    v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+    v = (v | (v << 8))  & 0x00FF00FF00FF00FFull;
+    v = (v | (v << 4))  & 0x0F0F0F0F0F0F0F0Full;
+    v = (v | (v << 2))  & 0x3333333333333333ull;
+    v = (v | (v << 1))  & 0x5555555555555555ull;
+    return v | (v << 1);
+}
+
+inline void store_be (uint8_t* out, uint64_t word)
+{
+    for (unsigned i=0; i<8; ++i)
+        out[i] = uint8_t(word >> (56 - 8*i));
+}
+
+}
+
+Display::Display()
+{
+    memset(bitplanes.data(), 0, sizeof(bitplanes));
+}
+
+void Display::clear()
+{
+    for (unsigned p=0; p<planes; ++p)
+        if (plane_mask & (1 << p))
+            memset(bitplanes[p].data(), 0, sizeof(Plane));
+}
+
+void Display::set_hires(bool enabled)
+{
+    hires_mode = enabled;
+    memset(bitplanes.data(), 0, sizeof(bitplanes));
+}
+
+bool Display::hires()
+{
+    return hires_mode;
+}
+
+unsigned Display::width()
+{
+    return hires_mode ? max_width : max_width / 2;
+}
+
+unsigned Display::height()
+{
+    return hires_mode ? max_height : max_height / 2;
+}
+
+void Display::select(uint8_t mask)
+{
+    plane_mask = mask & 0x03;
+}
+
+uint8_t Display::selected()
+{
+    return plane_mask;
+}
+
+template <bool clip>
+Display::Row Display::place(uint32_t bits, unsigned bits_width, unsigned x)
+{
+    // Mask with the sprite row starting at column x, either wrapped around
+    // or cut at the right edge
+
+    Row mask = {uint64_t(bits) << (64 - bits_width), 0};
+
+    if (!hires_mode) {
+        uint64_t v = mask.left;
+        mask.left = clip || x == 0 ? v >> x : (v >> x) | (v << (64 - x));
+        return mask;
+    }
+
+    Row wrapped = mask;
+    shift_right(mask.left, mask.right, x);
+    if (!clip && x > 0) {
+        shift_left(wrapped.left, wrapped.right, 128 - x);
+        mask.left |= wrapped.left;
+        mask.right |= wrapped.right;
+    }
+    return mask;
+}
+
+template <bool clip, unsigned sprite_width>
+bool Display::blit(Plane& rows, const uint8_t* sprite, unsigned count,
+                   unsigned x, unsigned y)
+{
+    const unsigned w = width();
+    const unsigned h = height();
+    x %= w;
+    y %= h;
+
+#ifdef __SSE2__
+    __m128i hits = _mm_setzero_si128();
+#else
+    uint64_t hits = 0;
+#endif
+
+    for (unsigned i=0; i<count; ++i)
+    {
+        unsigned line = y + i;
+        if (line >= h) {
+            if (clip)
+                break;
+            line -= h;
+        }
+
+        uint32_t bits = sprite[i * sprite_width/8];
+        if (sprite_width == 16)
+            bits = (bits << 8) | sprite[i*2 + 1];
+
+        Row mask = place<clip>(bits, sprite_width, x);
+        Row &row = rows[line];
+
+#ifdef __SSE2__
+        __m128i m = _mm_set_epi64x(int64_t(mask.right), int64_t(mask.left));
+        __m128i r = _mm_load_si128(reinterpret_cast<const __m128i*>(&row));
+        hits = _mm_or_si128(hits, _mm_and_si128(r, m));
+        _mm_store_si128(reinterpret_cast<__m128i*>(&row), _mm_xor_si128(r, m));
+#else
+        hits |= (row.left & mask.left) | (row.right & mask.right);
+        row.left ^= mask.left;
+        row.right ^= mask.right;
+#endif
+    }
+
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(hits, _mm_setzero_si128())) != 0xFFFF;
+#else
+    return hits != 0;
+#endif
+}
+
+template <bool clip>
+bool Display::draw(const uint8_t* sprite, unsigned count, unsigned x, unsigned y)
+{
+    // Draws an 8-pixel wide sprite on every selected plane, each plane
+    // taking the next count bytes. Returns true on collision in any plane.
+
+    bool collision = false;
+    for (unsigned p=0; p<planes; ++p) {
+        if (!(plane_mask & (1 << p)))
+            continue;
+        collision |= blit<clip, 8>(bitplanes[p], sprite, count, x, y);
+        sprite += count;
+    }
+    return collision;
+}
+
+template <bool clip>
+bool Display::draw16(const uint8_t* sprite, unsigned x, unsigned y)
+{
+    // Draws a 16x16 sprite (two bytes per row, 32 bytes per plane)
+
+    bool collision = false;
+    for (unsigned p=0; p<planes; ++p) {
+        if (!(plane_mask & (1 << p)))
+            continue;
+        collision |= blit<clip, 16>(bitplanes[p], sprite, 16, x, y);
+        sprite += 32;
+    }
+    return collision;
+}
+
+void Display::scroll_up(unsigned count)
+{
+    const unsigned h = height();
+    if (count > h)
+        count = h;
+
+    for (unsigned p=0; p<planes; ++p) {
+        if (!(plane_mask & (1 << p)))
+            continue;
+        auto &rows = bitplanes[p];
+        memmove(&rows[0], &rows[count], (h - count) * sizeof(Row));
+        memset(&rows[h - count], 0, count * sizeof(Row));
+    }
+}
+
+void Display::scroll_down(unsigned count)
+{
+    const unsigned h = height();
+    if (count > h)
+        count = h;
+
+    for (unsigned p=0; p<planes; ++p) {
+        if (!(plane_mask & (1 << p)))
+            continue;
+        auto &rows = bitplanes[p];
+        memmove(&rows[count], &rows[0], (h - count) * sizeof(Row));
+        memset(&rows[0], 0, count * sizeof(Row));
+    }
+}
+
+void Display::scroll_left(unsigned cols)
+{
+    for (unsigned p=0; p<planes; ++p) {
+        if (!(plane_mask & (1 << p)))
+            continue;
+        for (unsigned i=0; i<height(); ++i) {
+            auto &row = bitplanes[p][i];
+            if (hires_mode)
+                shift_left(row.left, row.right, cols);
+            else
+                row.left <<= cols;
+        }
+    }
+}
+
+void Display::scroll_right(unsigned cols)
+{
+    for (unsigned p=0; p<planes; ++p) {
+        if (!(plane_mask & (1 << p)))
+            continue;
+        for (unsigned i=0; i<height(); ++i) {
+            auto &row = bitplanes[p][i];
+            if (hires_mode)
+                shift_right(row.left, row.right, cols);
+            else
+                row.left >>= cols;
+        }
+    }
+}
+
+void Display::to_rgba(uint32_t* out, const Palette& palette)
+{
+    // Composites both planes through the palette into max_width x
+    // max_height pixels, doubling them in 64x32 mode. Pixels are looked up
+    // four at a time: each plane's nibble is spread into lane masks that
+    // pick one of the four palette entries.
+
+    const unsigned step = hires_mode ? 4 : 2; // Source pixels per 4 outputs
+
+#ifdef __SSE2__
+    const __m128i lanes = hires_mode ? _mm_set_epi32(1, 2, 4, 8)
+                                     : _mm_set_epi32(1, 1, 2, 2);
+    const __m128i color0 = _mm_set1_epi32(int32_t(palette[0]));
+    const __m128i color1 = _mm_set1_epi32(int32_t(palette[1]));
+    const __m128i color2 = _mm_set1_epi32(int32_t(palette[2]));
+    const __m128i color3 = _mm_set1_epi32(int32_t(palette[3]));
+
+    auto blend = [](__m128i mask, __m128i a, __m128i b) {
+        return _mm_or_si128(_mm_andnot_si128(mask, a), _mm_and_si128(mask, b));
+    };
+#endif
+
+    for (unsigned y=0; y<max_height; ++y)
+    {
+        uint32_t* line = out + y * max_width;
+
+        if (!hires_mode && y % 2 == 1) {
+            memcpy(line, line - max_width, max_width * sizeof(uint32_t));
+            continue;
+        }
+
+        const unsigned source = hires_mode ? y : y / 2;
+        const Row &row0 = bitplanes[0][source];
+        const Row &row1 = bitplanes[1][source];
+
+        for (unsigned x=0, col=0; x<max_width; x+=4, col+=step)
+        {
+            uint64_t word0 = col < 64 ? row0.left : row0.right;
+            uint64_t word1 = col < 64 ? row1.left : row1.right;
+            unsigned shift = 64 - step - col % 64;
+            uint32_t bits0 = uint32_t(word0 >> shift) & ((1u << step) - 1);
+            uint32_t bits1 = uint32_t(word1 >> shift) & ((1u << step) - 1);
+
+#ifdef __SSE2__
+            __m128i mask0 = _mm_and_si128(_mm_set1_epi32(int32_t(bits0)), lanes);
+            __m128i mask1 = _mm_and_si128(_mm_set1_epi32(int32_t(bits1)), lanes);
+            mask0 = _mm_cmpeq_epi32(mask0, lanes);
+            mask1 = _mm_cmpeq_epi32(mask1, lanes);
+
+            __m128i low  = blend(mask0, color0, color1);
+            __m128i high = blend(mask0, color2, color3);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(line + x),
+                             blend(mask1, low, high));
+#else
+            for (unsigned i=0; i<4; ++i) {
+                unsigned bit = step - 1 - i * step / 4;
+                unsigned index = ((bits0 >> bit) & 0x01)
+                               | ((bits1 >> bit) & 0x01) << 1;
+                line[x + i] = palette[index];
+            }
+#endif
+        }
+    }
+}
+
+void Display::to_indices(uint8_t* out)
+{
+    // One byte per pixel holding its plane bits (the palette index), over
+    // max_width x max_height with 64x32 pixels doubled
+
+    for (unsigned y=0; y<max_height; ++y)
+    {
+        uint8_t* line = out + y * max_width;
+
+        if (!hires_mode && y % 2 == 1) {
+            memcpy(line, line - max_width, max_width);
+            continue;
+        }
+
+        const unsigned source = hires_mode ? y : y / 2;
+        const Row &row0 = bitplanes[0][source];
+        const Row &row1 = bitplanes[1][source];
+
+        for (unsigned x=0; x<max_width; ++x) {
+            unsigned col = hires_mode ? x : x / 2;
+            unsigned shift = 63 - col % 64;
+            uint64_t word0 = col < 64 ? row0.left : row0.right;
+            uint64_t word1 = col < 64 ? row1.left : row1.right;
+            line[x] = uint8_t(((word0 >> shift) & 0x01)
+                            | ((word1 >> shift) & 0x01) << 1);
+        }
+    }
+}
+
+void Display::to_bits(uint8_t* out)
+{
+    // One bit per pixel, first pixel in the high bit: each plane in turn as
+    // max_height rows of max_width/8 bytes, with 64x32 pixels doubled
+
+    const unsigned stride = max_width / 8;
+
+    for (unsigned p=0; p<planes; ++p)
+        for (unsigned y=0; y<max_height; ++y)
+        {
+            uint8_t* line = out + (p * max_height + y) * stride;
+            const Row &row = bitplanes[p][hires_mode ? y : y / 2];
+
+            if (hires_mode) {
+                store_be(line, row.left);
+                store_be(line + 8, row.right);
+            } else {
+                store_be(line, spread(uint32_t(row.left >> 32)));
+                store_be(line + 8, spread(uint32_t(row.left)));
+            }
+        }
+}
+
+uint64_t Display::hash(uint64_t seed)
+{
+    uint8_t mode[] = {hires_mode, plane_mask};
+    seed = hash64(mode, sizeof(mode), seed);
+    for (auto &rows : bitplanes)
+        seed = hash64(rows.data(), height() * sizeof(Row), seed);
+    return seed;
+}
+
+template bool Display::draw<false>   (const uint8_t*, unsigned, unsigned, unsigned);
+template bool Display::draw<true>    (const uint8_t*, unsigned, unsigned, unsigned);
+template bool Display::draw16<false> (const uint8_t*, unsigned, unsigned);
+template bool Display::draw16<true>  (const uint8_t*, unsigned, unsigned);
@@ -0,0 +1,200 @@
+#include <CHIP-8/env.h>
+#include <CHIP-8/hash.h>
+
+#include <cstring>
+#include <functional>
+
+using namespace std;
+
+Env::Env (const Config& config):
+    config(config),
+    root(CPU::Mode::batch)
+{
+    if (this->config.frame_skip == 0)
+        this->config.frame_skip = 1;
+    if (this->config.frame_stack == 0)
+        this->config.frame_stack = 1;
+
+    this->config.rewards.clear();
+    for (auto &reward : config.rewards)
+        watch(reward);
+
+    root.set_quirks(config.quirks);
+    root.open_rom(config.rom);
+    root.save(boot);
+
+    const size_t n = config.instances;
+    for (size_t i=0; i<n; ++i)
+        instances.push_back(root.fork());
+
+    history.resize(n * this->config.frame_stack * frame_size());
+    newest.resize(n, 0);
+    episodes.resize(n, 0);
+    finished.resize(n, 0);
+
+    if (config.threads > 1)
+        pool.reset(new Pool(config.threads));
+}
+
+void Env::watch (Reward reward)
+{
+    reward.bytes = reward.bytes < 1 ? 1 : reward.bytes > 4 ? 4 : reward.bytes;
+    config.rewards.push_back(reward);
+    watched.resize(config.instances * config.rewards.size(), 0);
+}
+
+size_t Env::frame_size ()
+{
+    const size_t pixels = Display::max_width * Display::max_height;
+    return config.observation == Observation::bits
+         ? pixels / 8 * Display::planes
+         : pixels;
+}
+
+size_t Env::observation_size ()
+{
+    return frame_size() * config.frame_stack;
+}
+
+void Env::reset (uint64_t seed, uint8_t* observations)
+{
+    // Every instance restarts from the boot state, with its own RNG stream
+
+    this->seed = seed;
+    for (auto &count : episodes)
+        count = 0;
+
+    each([&](size_t i) {
+        restart(i, observations + i * observation_size());
+    });
+}
+
+void Env::step (const uint8_t* actions, uint8_t* observations,
+                float* rewards, uint8_t* dones)
+{
+    each([&](size_t i) {
+        uint8_t* observation = observations + i * observation_size();
+
+        if (finished[i]) {
+            restart(i, observation);
+            rewards[i] = 0;
+            dones[i] = 0;
+            return;
+        }
+        advance(i, actions[i], observation, &rewards[i], &dones[i]);
+    });
+}
+
+void Env::restart (size_t i, uint8_t* observation)
+{
+    CPU& cpu = *instances[i];
+
+    uint64_t key[] = {seed, i, episodes[i]++};
+    cpu.reset(boot, uint32_t(hash64(key, sizeof(key))));
+    finished[i] = 0;
+
+    auto &rewards = config.rewards;
+    for (size_t r=0; r<rewards.size(); ++r)
+        watched[i * rewards.size() + r] = value(i, rewards[r]);
+
+    observe(i, observation, true);
+}
+
+void Env::advance (size_t i, uint8_t action, uint8_t* observation,
+                   float* reward, uint8_t* done)
+{
+    CPU& cpu = *instances[i];
+
+    cpu.set_key(action == 0 || action >= actions ? 0xFF : action - 1);
+    for (unsigned f=0; f<config.frame_skip; ++f) {
+        cpu.advance(1);
+        if (cpu.status() != CPU::Status::running)
+            break;
+    }
+
+    // Differences are taken modulo the value's width, so counters that
+    // wrap still pay out their step
+    float total = 0;
+    auto &rewards = config.rewards;
+    for (size_t r=0; r<rewards.size(); ++r) {
+        uint32_t now = value(i, rewards[r]);
+        uint32_t &last = watched[i * rewards.size() + r];
+        unsigned bits = 8 * rewards[r].bytes;
+        uint32_t delta = now - last;
+        int64_t signed_delta = bits == 32 ? int64_t(int32_t(delta))
+                             : int64_t(delta << (32 - bits)) >> (32 - bits);
+        total += rewards[r].scale * float(signed_delta);
+        last = now;
+    }
+    *reward = total;
+
+    finished[i] = cpu.status() != CPU::Status::running;
+    *done = finished[i];
+
+    observe(i, observation, false);
+}
+
+void Env::observe (size_t i, uint8_t* observation, bool first)
+{
+    // A single frame goes straight to the caller's buffer; stacks are kept
+    // as a ring and copied out oldest first
+
+    Display& display = instances[i]->display();
+    auto render = [&](uint8_t* out) {
+        if (config.observation == Observation::bits)
+            display.to_bits(out);
+        else
+            display.to_indices(out);
+    };
+
+    const unsigned stack = config.frame_stack;
+    const size_t size = frame_size();
+    if (stack == 1) {
+        render(observation);
+        return;
+    }
+
+    uint8_t* frames = history.data() + i * stack * size;
+    newest[i] = first ? 0 : (newest[i] + 1) % stack;
+    render(frames + newest[i] * size);
+
+    // A new episode starts with its first frame repeated
+    if (first)
+        for (unsigned f=1; f<stack; ++f)
+            memcpy(frames + f * size, frames, size);
+
+    for (unsigned f=0; f<stack; ++f) {
+        unsigned oldest = (newest[i] + 1 + f) % stack;
+        memcpy(observation + f * size, frames + oldest * size, size);
+    }
+}
+
+uint32_t Env::value (size_t i, const Reward& reward)
+{
+    uint32_t result = 0;
+    for (unsigned b=0; b<reward.bytes; ++b)
+        result = (result << 8) | instances[i]->peek(uint16_t(reward.addr + b));
+    return result;
+}
+
+template <typename F>
+void Env::each (F job)
+{
+    // Instances split in contiguous chunks, one per worker
+
+    const size_t n = instances.size();
+    if (!pool) {
+        for (size_t i=0; i<n; ++i)
+            job(i);
+        return;
+    }
+
+    // Captures no more than two pointers, so the function holds it without
+    // allocating either
+    const function<void(size_t)> chunk = [this, &job](size_t c) {
+        const size_t n = instances.size(), chunks = config.threads;
+        for (size_t i = n * c / chunks; i < n * (c + 1) / chunks; ++i)
+            job(i);
+    };
+    pool->run(config.threads, chunk);
+}
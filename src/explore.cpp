@@ -0,0 +1,84 @@
+#include <CHIP-8/cpu.h>
+#include <CHIP-8/explorer.h>
+#include <CHIP-8/rom.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Usage: CHIP-8-explore [--depth N] [--states N] [--threads N] [--quirks profile]
+//                       [--db file] rom...
+//
+// Explores every rom breadth-first over keypad input, one frame per level,
+// until N levels deep or N distinct states. Reports how many distinct
+// states were reached, the rate at which frames were expanded, and which
+// share of the rom's bytes ever ran as part of an opcode.
+
+int main(int argc, char *argv[])
+{
+    uint64_t depth = 60;
+    size_t   max_states = 100000;
+    unsigned threads = thread::hardware_concurrency();
+    auto quirks = Quirks::Profile::modern;
+    bool use_quirks = false;
+    vector<string> roms;
+
+    for (int i=1; i<argc; ++i) {
+        if (!strcmp(argv[i], "--depth") && i+1 < argc)
+            depth = strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--states") && i+1 < argc)
+            max_states = strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--threads") && i+1 < argc)
+            threads = strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--quirks") && i+1 < argc) {
+            quirks = Quirks::profile(argv[++i]);
+            use_quirks = true;
+        }
+        else if (!strcmp(argv[i], "--db") && i+1 < argc)
+            Rom::read_metadata(argv[++i]);
+        else
+            roms.push_back(argv[i]);
+    }
+
+    Explorer explorer(threads);
+
+    printf("%-24s %6s %10s %8s %12s %8s %7s\n", "rom", "depth", "states",
+           "ended", "states/s", "pcs", "bytes");
+
+    for (auto &path : roms)
+    {
+        CPU cpu(CPU::Mode::batch);
+        if (use_quirks)
+            cpu.set_quirks(quirks);
+        try {
+            cpu.open_rom(path);
+        }
+        catch (const runtime_error& error) {
+            printf("%s\n", error.what());
+            continue;
+        }
+
+        auto report = explorer.explore(cpu, depth, max_states);
+
+        // Each address run covers its opcode's two bytes, whatever their
+        // alignment, so the share never goes past the whole rom
+        size_t size = Rom::open(path).size();
+        size_t covered = 0;
+        for (size_t addr=0x200; addr<0x200 + size; ++addr)
+            covered += report.pcs[addr] || (addr > 0x200 && report.pcs[addr-1]);
+
+        double seconds = report.seconds > 0 ? report.seconds : 1e-9;
+        printf("%-24s %6llu %10llu %8llu %12.0f %8zu %6.1f%%\n", path.c_str(),
+               (unsigned long long) report.levels,
+               (unsigned long long) report.states,
+               (unsigned long long) report.terminal,
+               report.expanded / seconds, report.pcs.count(),
+               size ? 100.0 * covered / size : 0.0);
+    }
+}
@@ -0,0 +1,95 @@
+#include <CHIP-8/explorer.h>
+#include <CHIP-8/hash_set.h>
+#include <CHIP-8/pool.h>
+#include <CHIP-8/timer.h>
+
+#include <atomic>
+#include <future>
+#include <iterator>
+#include <vector>
+
+using namespace std;
+
+Explorer::Explorer (unsigned threads):
+    threads(threads ? threads : 1)
+{
+}
+
+Explorer::Report Explorer::explore (CPU& root, uint64_t depth, size_t max_states)
+{
+    Report report;
+    HashSet seen(2 * max_states + threads);
+    Timer<chrono::nanoseconds> wall;
+    wall.start();
+
+    vector<CPU::State> frontier(1);
+    root.save(frontier[0]);
+    seen.insert(root.hash());
+
+    // One headless instance per worker, loaded with each state in turn
+    Pool pool(threads);
+    vector<CPU::Branch>          runners;
+    vector<CPU::Coverage>        maps(threads);
+    vector<vector<CPU::State>>   found(threads);
+    vector<uint64_t>             expanded(threads, 0);
+    vector<uint64_t>             terminal(threads, 0);
+    for (unsigned t=0; t<threads; ++t) {
+        runners.push_back(root.fork());
+        runners[t]->set_coverage(&maps[t]);
+    }
+
+    while (report.levels < depth && !frontier.empty()
+                                 && seen.size() < max_states)
+    {
+        atomic<size_t> next{0};
+        vector<future<void>> jobs;
+
+        for (unsigned t=0; t<threads; ++t)
+            jobs.push_back(pool.submit([&, t] {
+                CPU& cpu = *runners[t];
+                size_t i;
+                while ((i = next++) < frontier.size()) {
+                    // No key first, then 0 to F
+                    for (unsigned k=0; k<=16; ++k) {
+                        if (seen.size() >= max_states)
+                            return;
+
+                        cpu.load(frontier[i]);
+                        cpu.set_key(k == 0 ? 0xFF : k - 1);
+                        cpu.advance(1);
+                        ++expanded[t];
+
+                        if (!seen.insert(cpu.hash()))
+                            continue;
+                        if (cpu.status() != CPU::Status::running) {
+                            ++terminal[t];
+                            continue;
+                        }
+                        found[t].emplace_back();
+                        cpu.save(found[t].back());
+                    }
+                }
+            }));
+
+        for (auto &job : jobs)
+            job.get();
+
+        frontier.clear();
+        for (auto &states : found) {
+            frontier.insert(frontier.end(), make_move_iterator(states.begin()),
+                                            make_move_iterator(states.end()));
+            states.clear();
+        }
+        ++report.levels;
+    }
+
+    wall.stop();
+    report.seconds = wall.getTime() / 1e9;
+    report.states = seen.size();
+    for (unsigned t=0; t<threads; ++t) {
+        report.expanded += expanded[t];
+        report.terminal += terminal[t];
+        report.pcs |= maps[t];
+    }
+    return report;
+}
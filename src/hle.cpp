@@ -0,0 +1,153 @@
+#include <CHIP-8/code.h>
+#include <CHIP-8/hle.h>
+
+using namespace std;
+
+namespace {
+
+struct Signature {
+    Routine     routine;
+    const char* code[Hle::max_length + 1]; // Ends at nullptr
+};
+
+// Tried in order. Fields not in a signature are left at 0xFFFF.
+const Signature signatures[] = {
+    {Routine::score, {"Fs33", "F265",                                 // Digits of VS
+                      "F029", "Dabn", "7akk",                         // Hundreds
+                      "F129", "Dabn", "7akk",                         // Tens
+                      "F229", "Dabn", "00EE"}},                       // Units
+    {Routine::fill,  {"Fx55", "Fr1E", "7ckk", "3cee", "1ttt", "00EE"}},
+    {Routine::fill,  {"Fx55",         "7ckk", "3cee", "1ttt", "00EE"}},
+    {Routine::copy,  {"Fx65", "Fa1E", "Fx55", "Fb1E", "7ckk", "3cee", "1ttt", "00EE"}},
+};
+
+}
+
+const Match* Hle::find (const Memory& RAM, uint16_t target, uint16_t program_end)
+{
+    // The routine at target, if it is a known one, nullptr otherwise
+
+    ++counters.calls;
+
+    array<uint8_t, 2 * max_length> code;
+    for (unsigned i=0; i<code.size(); ++i)
+        code[i] = RAM[uint16_t(target + i)];
+
+    auto it = entries.find(target);
+    if (it == entries.end() || it->second.code != code) {
+        Entry entry;
+        entry.code = code;
+        for (auto &signature : signatures)
+            if (matches(RAM, target, signature.code, entry.match)) {
+                entry.match.routine = signature.routine;
+                if (valid(entry.match))
+                    break;
+            }
+        if (!valid(entry.match))
+            entry.match = Match();
+        it = entries.insert_or_assign(target, entry).first;
+    }
+
+    const Match& match = it->second.match;
+    if (match.routine == Routine::none || match.start + match.length > program_end)
+        return nullptr;
+    return &match;
+}
+
+bool Hle::matches (const Memory& RAM, uint16_t target, const char* const* signature,
+                   Match& match)
+{
+    // Every pattern against the opcode in its place, binding fields
+
+    match = Match();
+    match.start = target;
+    match.fields.fill(0xFFFF);
+
+    unsigned i = 0;
+    for (; signature[i]; ++i) {
+        uint16_t addr = uint16_t(target + 2*i);
+        uint16_t opcode = uint16_t(RAM[addr] << 8 | RAM[uint16_t(addr + 1)]);
+        const char* pattern = signature[i];
+
+        for (unsigned k=0; k<4; ) {
+            char c = pattern[k];
+            if (c < 'a' || c > 'z') {
+                if (to_char(uint8_t(opcode >> 4*(3-k)) & 0x0F) != c)
+                    return false;
+                ++k;
+                continue;
+            }
+
+            // A field runs over every nibble with the same letter
+            unsigned end = k;
+            uint16_t value = 0;
+            while (end < 4 && pattern[end] == c)
+                value = uint16_t(value << 4 | ((opcode >> 4*(3-end)) & 0x0F)), ++end;
+
+            uint16_t &field = match.fields[size_t(c - 'a')];
+            if (field != 0xFFFF && field != value)
+                return false;
+            field = value;
+            k = end;
+        }
+    }
+
+    match.length = uint16_t(2 * i);
+    return match.field('t') == 0xFFFF || match.field('t') == target;
+}
+
+bool Hle::valid (const Match& match)
+{
+    // Whether the bound registers leave the native version exact: none is
+    // VF, which the loops' adds keep changing, the counter only changes
+    // through its add, and the I steps stay the same every time round
+
+    for (char reg : {'s', 'a', 'b', 'x', 'r', 'c'})
+        if (match.field(reg) == 0xF)
+            return false;
+
+    auto x = match.field('x'), r = match.field('r'), c = match.field('c');
+    auto a = match.field('a'), b = match.field('b');
+
+    switch (match.routine) {
+        case Routine::score:
+            return true;
+        case Routine::fill:
+            return r != c;
+        case Routine::copy:
+            return c > x && a > x && b > x && a != c && b != c;
+        default:
+            return false;
+    }
+}
+
+void Hle::account (uint64_t instructions, bool mismatched)
+{
+    ++counters.replaced;
+    counters.instructions += instructions;
+    if (mismatched)
+        ++counters.mismatched;
+}
+
+void Hle::set_mode (Mode mode)
+{
+    current = mode;
+}
+
+void Hle::reset ()
+{
+    // Forgets every match and zeroes the stats, keeping the mode
+
+    entries.clear();
+    counters = Stats();
+}
+
+Hle::Mode Hle::mode () const
+{
+    return current;
+}
+
+Hle::Stats Hle::stats () const
+{
+    return counters;
+}
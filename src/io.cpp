@@ -1,4 +1,5 @@
 #include <CHIP-8/io.h>
+#include <CHIP-8/trace.h>
 #include <stdexcept>
 
 using namespace std;
@@ -8,7 +9,7 @@ IO::IO (String title, Pixels width, Pixels height, Scale scale) :
 {
     init_SDL();
 
-    pixels.resize(width * height);
+    pixels.resize(Display::max_width * Display::max_height);
     for (unsigned i=0; i<pixels.capacity(); ++i)
         pixels[i] = 0x000000FF;
 
@@ -16,8 +17,16 @@ IO::IO (String title, Pixels width, Pixels height, Scale scale) :
     clear();
 }
 
+IO::IO () :
+    title(""), width(0), height(0), scale(1), headless(true)
+{
+}
+
 IO::~IO ()
 {
+    if (headless)
+        return;
+
     SDL_DestroyRenderer(renderer);
     SDL_DestroyTexture(texture);
     SDL_DestroyWindow(window);
@@ -41,34 +50,18 @@ IO::RGBA::RGBA(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha) :
 
 void IO::clear ()
 {
-    SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xFF);
-    SDL_RenderPresent(renderer);
-    SDL_RenderClear(renderer);
+    if (!headless) {
+        SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xFF);
+        SDL_RenderPresent(renderer);
+        SDL_RenderClear(renderer);
+    }
 
-    for (unsigned i=0; i<pixels.size(); ++i)
-        pixels[i] = 0x000000FF;
+    screen.clear();
 }
 
-bool IO::draw (const Sprite& sprite, Coord x, Coord y)
+Display& IO::display ()
 {
-    bool collision = false;
-
-    for (unsigned col=0; col<sprite.size(); ++col)
-    {
-        auto wrap_x = (x + col) % width;
-        auto wrap_y = y % height;
-        unsigned index = (width * wrap_y) + wrap_x;
-
-        if (pixels[index] > 0xFF && sprite[col] > 0xFF)
-            collision = true;
-
-        if (pixels[index] != sprite[col])
-            pixels[index] = 0xFFFFFFFF;
-        else
-            pixels[index] = 0x000000FF;
-    }
-
-    return collision;
+    return screen;
 }
 
 void IO::assert(bool expr, string error_msg)
@@ -101,17 +94,33 @@ void IO::init_SDL()
         renderer,
         SDL_PIXELFORMAT_RGBA8888,
         SDL_TEXTUREACCESS_STATIC,
-        int(width),
-        int(height));
+        int(Display::max_width),
+        int(Display::max_height));
+}
+
+void IO::hold_display (bool held)
+{
+    this->held = held;
 }
 
 void IO::refresh_display()
 {
+    if (!held)
+        present();
+}
+
+void IO::present()
+{
+    if (headless)
+        return;
+
+    Trace::Zone zone("present");
+    screen.to_rgba(&pixels[0], palette);
     SDL_UpdateTexture(
         texture,
         nullptr,
         &pixels[0],
-        int(width * 4));
+        int(Display::max_width * 4));
 
     SDL_RenderClear(renderer);
     SDL_RenderCopy(renderer, texture, nullptr, nullptr);
@@ -120,12 +129,24 @@ void IO::refresh_display()
 
 uint8_t IO::wait_key()
 {
+    // Headless instances have no event source to wait on
+    if (headless)
+        return last_key();
+
     while (!key_pressed)
         update();
 
     return key_value;
 }
 
+void IO::set_key(uint8_t key)
+{
+    // Holds a key (0xFF releases it), for instances without a keyboard
+
+    key_value = key;
+    key_pressed = key != 0xFF;
+}
+
 uint8_t IO::last_key()
 {
     if (key_pressed)
@@ -136,11 +157,20 @@ uint8_t IO::last_key()
 
 void IO::update()
 {
-    SDL_PollEvent( &event );
+    if (headless)
+        return;
+
+    bool polled = SDL_PollEvent( &event ) == 1;
 
     if (event.type == SDL_QUIT)
         exit(EXIT_SUCCESS);
 
+    // event keeps the last one when there is none new, which must not
+    // toggle tracing again
+    if (polled && event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F12
+                                            && event.key.repeat == 0)
+        Trace::toggle();
+
     if (event.key.type == SDL_KEYDOWN && !key_pressed) {
         switch (event.key.keysym.sym) {
             case SDLK_1: key_value = 0x1; break;
@@ -0,0 +1,264 @@
+#include <CHIP-8/code.h>
+#include <CHIP-8/ir.h>
+
+using namespace std;
+
+namespace {
+
+const unsigned VF = 0xF;
+const unsigned RI = 16; // I, after the V registers, in liveness and constants
+
+}
+
+bool Ir::lifts (const Instr& instr)
+{
+    // Register operations that fall through, with VF only as a load target
+
+    switch (instr.op) {
+        case Op::LD_XB: case Op::LD_XY: case Op::LD_I: case Op::ADD_I_X:
+            return true;
+        case Op::ADD_XB: case Op::OR:  case Op::AND:  case Op::XOR:
+        case Op::ADD_XY: case Op::SUB: case Op::SHR:  case Op::SUBN: case Op::SHL:
+            return instr.x != VF;
+        default:
+            return false;
+    }
+}
+
+uint8_t Ir::alu (Kind kind, uint8_t a, uint8_t b, uint8_t& flag)
+{
+    // Same results and flags as CPU::ADD, SUB, SUBN, OR, AND, XOR, SHR and
+    // SHL, the flag of a logic operation being the cleared VF
+
+    switch (kind) {
+        case Kind::add:  flag = a + b > 0xFF; return uint8_t(a + b);
+        case Kind::sub:  flag = a >= b;       return uint8_t(a - b);
+        case Kind::subn: flag = b >= a;       return uint8_t(b - a);
+        case Kind::or_:  flag = 0;            return a | b;
+        case Kind::and_: flag = 0;            return a & b;
+        case Kind::xor_: flag = 0;            return a ^ b;
+        case Kind::shr:  flag = b & 0x01;     return b >> 1;
+        case Kind::shl:  flag = b >> 7;       return uint8_t(b << 1);
+        default:         flag = 0;            return a;
+    }
+}
+
+void Ir::lift (const Instr* instrs, unsigned count, Options options)
+{
+    // One node per instruction, as the CPU would run it, then optimized
+
+    code.clear();
+    for (unsigned i=0; i<count; ++i) {
+        const Instr& instr = instrs[i];
+        uint8_t x = instr.x, y = instr.y;
+        uint8_t shifted = options.shift_vy ? y : x;
+
+        switch (instr.op) {
+            case Op::LD_XB:   code.push_back({Kind::set,   x, 0, true, false, instr.byte()}); break;
+            case Op::ADD_XB:  code.push_back({Kind::add,   x, 0, true, true,  instr.byte()}); break;
+            case Op::LD_XY:   code.push_back({Kind::move,  x, y, false, false, 0});  break;
+            case Op::OR:      code.push_back({Kind::or_,   x, y, false, options.logic_vf, 0}); break;
+            case Op::AND:     code.push_back({Kind::and_,  x, y, false, options.logic_vf, 0}); break;
+            case Op::XOR:     code.push_back({Kind::xor_,  x, y, false, options.logic_vf, 0}); break;
+            case Op::ADD_XY:  code.push_back({Kind::add,   x, y, false, true,  0});  break;
+            case Op::SUB:     code.push_back({Kind::sub,   x, y, false, true,  0});  break;
+            case Op::SUBN:    code.push_back({Kind::subn,  x, y, false, true,  0});  break;
+            case Op::SHR:     code.push_back({Kind::shr,   x, shifted, false, true, 0}); break;
+            case Op::SHL:     code.push_back({Kind::shl,   x, shifted, false, true, 0}); break;
+            case Op::LD_I:    code.push_back({Kind::set_i, 0, 0, true, false, instr.addr}); break;
+            case Op::ADD_I_X: code.push_back({Kind::add_i, 0, x, false, false, 0});  break;
+            default: break;
+        }
+    }
+
+    fold();
+    eliminate();
+    combine();
+}
+
+void Ir::run (uint8_t* V, uint16_t& I) const
+{
+    for (const Node& node : code) {
+        uint8_t b = node.constant ? uint8_t(node.imm) : V[node.src];
+        switch (node.kind) {
+            case Kind::set:   V[node.dst] = uint8_t(node.imm); break;
+            case Kind::move:  V[node.dst] = b;                 break;
+            case Kind::set_i: I = node.imm;                    break;
+            case Kind::add_i: I = uint16_t(I + b);             break;
+            default: {
+                uint8_t flag;
+                V[node.dst] = alu(node.kind, V[node.dst], b, flag);
+                if (node.flag)
+                    V[VF] = flag;
+            }
+        }
+    }
+}
+
+unsigned Ir::size () const
+{
+    return unsigned(code.size());
+}
+
+void Ir::fold ()
+{
+    // Registers loaded with constants are tracked instead of written, and
+    // operations on constants are computed here. A constant is written
+    // out only before an operation that reads its register as a whole, or
+    // at the end.
+
+    int known[RI + 1];
+    bool pending[RI + 1] = {};
+    for (auto &value : known)
+        value = -1;
+
+    vector<Node> folded;
+    auto materialize = [&](unsigned reg) {
+        if (!pending[reg])
+            return;
+        if (reg == RI)
+            folded.push_back({Kind::set_i, 0, 0, true, false, uint16_t(known[reg])});
+        else
+            folded.push_back({Kind::set, uint8_t(reg), 0, true, false, uint16_t(known[reg])});
+        pending[reg] = false;
+    };
+    auto constant = [&](unsigned reg, int value) {
+        known[reg] = value;
+        pending[reg] = true;
+    };
+    auto unknown = [&](unsigned reg) {
+        known[reg] = -1;
+        pending[reg] = false;
+    };
+
+    for (Node node : code) {
+        int b = node.constant ? node.imm : known[node.src];
+        if (b >= 0 && !node.constant) {
+            node.constant = true;
+            node.imm = uint16_t(b);
+        }
+
+        switch (node.kind) {
+            case Kind::set:
+                constant(node.dst, node.imm);
+                break;
+            case Kind::set_i:
+                constant(RI, node.imm);
+                break;
+            case Kind::move:
+                if (b >= 0)
+                    constant(node.dst, b);
+                else {
+                    folded.push_back(node);
+                    unknown(node.dst);
+                }
+                break;
+            case Kind::add_i:
+                if (b >= 0 && known[RI] >= 0)
+                    constant(RI, uint16_t(known[RI] + b));
+                else {
+                    materialize(RI);
+                    folded.push_back(node);
+                    unknown(RI);
+                }
+                break;
+            default: {
+                bool shift = node.kind == Kind::shr || node.kind == Kind::shl;
+                int a = shift ? 0 : known[node.dst];
+                if (b >= 0 && a >= 0) {
+                    uint8_t flag;
+                    constant(node.dst, alu(node.kind, uint8_t(a), uint8_t(b), flag));
+                    if (node.flag)
+                        constant(VF, flag);
+                }
+                else {
+                    if (!shift)
+                        materialize(node.dst);
+                    folded.push_back(node);
+                    unknown(node.dst);
+                    if (node.flag)
+                        unknown(VF);
+                }
+            }
+        }
+    }
+
+    for (unsigned reg=0; reg<=RI; ++reg)
+        materialize(reg);
+    code.swap(folded);
+}
+
+void Ir::eliminate ()
+{
+    // Backwards, with every register and I live at the end: a node whose
+    // results are all overwritten before being read goes away, and one
+    // whose flag is overwritten first stops writing it
+
+    uint32_t live = (1u << (RI + 1)) - 1;
+    vector<Node> kept;
+
+    for (size_t i=code.size(); i-- > 0; ) {
+        Node node = code[i];
+        bool on_i = node.kind == Kind::set_i || node.kind == Kind::add_i;
+        uint32_t writes = 1u << (on_i ? RI : node.dst);
+
+        if (node.flag && !(live & (1u << VF)))
+            node.flag = false;
+        if (!(live & writes) && !node.flag)
+            continue;
+
+        live &= ~writes;
+        if (node.flag)
+            live &= ~(1u << VF);
+
+        if (!node.constant)
+            live |= 1u << node.src;
+        switch (node.kind) {
+            case Kind::set: case Kind::set_i: case Kind::move:
+            case Kind::shr: case Kind::shl:
+                break;
+            case Kind::add_i:
+                live |= 1u << RI;
+                break;
+            default:
+                live |= 1u << node.dst;
+        }
+        kept.push_back(node);
+    }
+
+    code.assign(kept.rbegin(), kept.rend());
+}
+
+void Ir::combine ()
+{
+    // A constant add whose carry is dead is merged into the previous one
+    // on its register, if that one's carry is dead too and nothing reads
+    // or writes the register in between
+
+    auto touches = [](const Node& node, uint8_t reg) {
+        bool on_i = node.kind == Kind::set_i || node.kind == Kind::add_i;
+        return (!on_i && node.dst == reg) || (!node.constant && node.src == reg)
+            || (node.flag && reg == VF);
+    };
+    auto mergeable = [](const Node& node) {
+        return node.kind == Kind::add && node.constant && !node.flag;
+    };
+
+    vector<Node> merged;
+    for (const Node& node : code) {
+        if (mergeable(node)) {
+            size_t k = merged.size();
+            while (k > 0 && !touches(merged[k-1], node.dst))
+                --k;
+            if (k > 0 && mergeable(merged[k-1]) && merged[k-1].dst == node.dst) {
+                Node& into = merged[k-1];
+                into.imm = uint8_t(into.imm + node.imm);
+                if (!into.imm)
+                    merged.erase(merged.begin() + (k-1));
+                continue;
+            }
+        }
+        merged.push_back(node);
+    }
+    code.swap(merged);
+}
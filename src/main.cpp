@@ -1,13 +1,51 @@
 #include <CHIP-8/cpu.h>
+#include <CHIP-8/rom.h>
+#include <CHIP-8/trace.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
 
 int main(int argc, char *argv[])
 {
     CPU cpu;
     std::string path;
+    std::string quirks;
 
     // Escribir la ruta del rom entre las comillas
     path = "";
 
-    cpu.open_rom(path);
+    // CHIP-8 [--trace archivo.json] [--quirks modern|vip|schip|xochip]
+    //        [--db archivo] [--audio-sync] [--run-ahead N] [--speculate] [rom]
+    for (int i=1; i<argc; ++i) {
+        if (!strcmp(argv[i], "--trace") && i+1 < argc)
+            Trace::start(argv[++i]);
+        else if (!strcmp(argv[i], "--quirks") && i+1 < argc)
+            quirks = argv[++i];
+        else if (!strcmp(argv[i], "--db") && i+1 < argc)
+            Rom::read_metadata(argv[++i]);
+        else if (!strcmp(argv[i], "--audio-sync"))
+            cpu.sync_to_audio();
+        else if (!strcmp(argv[i], "--run-ahead") && i+1 < argc)
+            cpu.set_run_ahead(unsigned(atoi(argv[++i])));
+        else if (!strcmp(argv[i], "--speculate"))
+            cpu.set_speculative(true);
+        else
+            path = argv[i];
+    }
+
+    // An explicit profile wins over the one known for the rom
+    if (!quirks.empty())
+        cpu.set_quirks(Quirks::profile(quirks));
+
+    try {
+        cpu.open_rom(path);
+    }
+    catch (const std::runtime_error& error) {
+        fprintf(stderr, "%s\n", error.what());
+        return EXIT_FAILURE;
+    }
+
     cpu.run();
 }
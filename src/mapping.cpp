@@ -0,0 +1,89 @@
+#include <CHIP-8/mapping.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+
+Mapping::Mapping (const string& path)
+{
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                                nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                                nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+        return;
+    file = handle;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+        return;
+
+    mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping)
+        return;
+
+    view = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (view)
+        length = size_t(size.QuadPart);
+}
+
+Mapping::~Mapping ()
+{
+    if (view)
+        UnmapViewOfFile(view);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file)
+        CloseHandle(file);
+}
+
+#else
+
+Mapping::Mapping (const string& path)
+{
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+        return;
+
+    struct stat info;
+    if (fstat(file, &info) == 0 && info.st_size > 0) {
+        void* address = mmap(nullptr, size_t(info.st_size), PROT_READ,
+                             MAP_SHARED, file, 0);
+        if (address != MAP_FAILED) {
+            view = static_cast<const uint8_t*>(address);
+            length = size_t(info.st_size);
+        }
+    }
+    close(file);
+}
+
+Mapping::~Mapping ()
+{
+    if (view)
+        munmap(const_cast<uint8_t*>(view), length);
+}
+
+#endif
+
+bool Mapping::valid ()
+{
+    return view != nullptr;
+}
+
+const uint8_t* Mapping::data ()
+{
+    return view;
+}
+
+size_t Mapping::size ()
+{
+    return length;
+}
@@ -0,0 +1,182 @@
+#include <CHIP-8/hash.h>
+#include <CHIP-8/memory.h>
+
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// Pages go back to a free list instead of the heap, and pages handed to
+// share() are indexed by content. Both are global so any thread may
+// drop the last reference.
+
+mutex pool_mutex;
+vector<void*> free_pages;
+
+mutex shared_mutex;
+unordered_multimap<uint64_t, void*> shared_pages;
+
+}
+
+Memory::Memory ()
+{
+    Page* empty = zero();
+    for (auto &page : table) {
+        retain(empty);
+        page = empty;
+    }
+}
+
+Memory::Memory (const Memory& other) :
+    table(other.table)
+{
+    for (auto page : table)
+        retain(page);
+}
+
+Memory::~Memory ()
+{
+    for (auto page : table)
+        release(page);
+}
+
+Memory& Memory::operator= (const Memory& other)
+{
+    for (unsigned i=0; i<pages; ++i) {
+        if (table[i] == other.table[i])
+            continue;
+        retain(other.table[i]);
+        release(table[i]);
+        table[i] = other.table[i];
+    }
+    return *this;
+}
+
+void Memory::load (uint16_t addr, const uint8_t* data, size_t size)
+{
+    // Bulk write, a page at a time, wrapping around like write(). Pages
+    // that are fully overwritten are never copied first.
+
+    while (size > 0) {
+        unsigned offset = addr % page_size;
+        size_t count = size < page_size - offset ? size : page_size - offset;
+
+        Page* &page = table[addr / page_size];
+        if (page->refs.load(memory_order_acquire) > 1) {
+            Page* copy = allocate();
+            if (count < page_size)
+                memcpy(copy->data, page->data, page_size);
+            release(page);
+            page = copy;
+        }
+        memcpy(page->data + offset, data, count);
+        page->digest.store(0, memory_order_relaxed);
+
+        addr = uint16_t(addr + count);
+        data += count;
+        size -= count;
+    }
+}
+
+void Memory::share ()
+{
+    // Replaces every private page with an identical shared one, or makes
+    // it the shared one. Shared pages stay alive for the whole run.
+
+    lock_guard<mutex> lock(shared_mutex);
+
+    for (auto &page : table) {
+        if (page->refs.load(memory_order_acquire) > 1)
+            continue;
+
+        auto key = hash64(page->data, page_size);
+        auto range = shared_pages.equal_range(key);
+
+        Page* known = nullptr;
+        for (auto it = range.first; it != range.second && !known; ++it) {
+            auto candidate = static_cast<Page*>(it->second);
+            if (!memcmp(candidate->data, page->data, page_size))
+                known = candidate;
+        }
+
+        if (known) {
+            retain(known);
+            release(page);
+            page = known;
+        } else {
+            retain(page);
+            shared_pages.emplace(key, page);
+        }
+    }
+}
+
+uint64_t Memory::hash (uint64_t seed) const
+{
+    // Hash of the page hashes. A page's own hash is kept until it is
+    // written, so unchanged and shared pages are only read once.
+
+    array<uint64_t, pages> digests;
+    for (unsigned i=0; i<pages; ++i)
+        digests[i] = digest(i);
+    return hash64(digests.data(), sizeof(digests), seed);
+}
+
+uint64_t Memory::digest (unsigned index) const
+{
+    // Content hash of one page, never 0
+
+    Page* page = table[index];
+    uint64_t digest = page->digest.load(memory_order_relaxed);
+    if (!digest) {
+        digest = hash64(page->data, page_size) | 1;
+        page->digest.store(digest, memory_order_relaxed);
+    }
+    return digest;
+}
+
+Memory::Page* Memory::allocate ()
+{
+    Page* page = nullptr;
+    {
+        lock_guard<mutex> lock(pool_mutex);
+        if (!free_pages.empty()) {
+            page = static_cast<Page*>(free_pages.back());
+            free_pages.pop_back();
+        }
+    }
+    if (!page)
+        page = new Page;
+
+    page->refs.store(1, memory_order_relaxed);
+    page->digest.store(0, memory_order_relaxed);
+    return page;
+}
+
+void Memory::retain (Page* page)
+{
+    page->refs.fetch_add(1, memory_order_relaxed);
+}
+
+void Memory::release (Page* page)
+{
+    if (page->refs.fetch_sub(1, memory_order_acq_rel) != 1)
+        return;
+
+    lock_guard<mutex> lock(pool_mutex);
+    free_pages.push_back(page);
+}
+
+Memory::Page* Memory::zero ()
+{
+    // Never freed: the static itself holds a reference
+    static Page* page = [] {
+        Page* empty = allocate();
+        memset(empty->data, 0, page_size);
+        return empty;
+    }();
+    return page;
+}
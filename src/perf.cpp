@@ -0,0 +1,107 @@
+#include <CHIP-8/perf.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+using namespace std;
+
+struct Perf::Impl {
+    enum { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, COUNT };
+    int fd[COUNT] = {-1, -1, -1, -1};
+    void     open(int event, uint32_t type, uint64_t config);
+    uint64_t read(int event);
+};
+
+#ifdef __linux__
+
+void Perf::Impl::open(int event, uint32_t type, uint64_t config)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    fd[event] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+uint64_t Perf::Impl::read(int event)
+{
+    uint64_t value = 0;
+    if (fd[event] < 0 || ::read(fd[event], &value, sizeof(value)) != sizeof(value))
+        return 0;
+    return value;
+}
+
+Perf::Perf():
+    pimpl(new Impl())
+{
+    pimpl->open(Impl::CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    pimpl->open(Impl::INSTRUCTIONS, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    pimpl->open(Impl::BRANCH_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    pimpl->open(Impl::L1D_MISSES, PERF_TYPE_HW_CACHE,
+                PERF_COUNT_HW_CACHE_L1D |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+}
+
+Perf::~Perf()
+{
+    for (auto fd : pimpl->fd)
+        if (fd >= 0)
+            close(fd);
+}
+
+bool Perf::available()
+{
+    // Cycles and instructions are the minimum needed for useful ratios
+    return pimpl->fd[Impl::CYCLES] >= 0 && pimpl->fd[Impl::INSTRUCTIONS] >= 0;
+}
+
+void Perf::start()
+{
+    for (auto fd : pimpl->fd) {
+        if (fd < 0)
+            continue;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+Perf::Counters Perf::stop()
+{
+    for (auto fd : pimpl->fd)
+        if (fd >= 0)
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+    Counters counters;
+    counters.cycles        = pimpl->read(Impl::CYCLES);
+    counters.instructions  = pimpl->read(Impl::INSTRUCTIONS);
+    counters.branch_misses = pimpl->read(Impl::BRANCH_MISSES);
+    counters.l1d_misses    = pimpl->read(Impl::L1D_MISSES);
+    return counters;
+}
+
+#else
+
+// Hardware counters are only implemented on Linux
+
+void Perf::Impl::open(int, uint32_t, uint64_t) {}
+uint64_t Perf::Impl::read(int) { return 0; }
+
+Perf::Perf() : pimpl(new Impl()) {}
+Perf::~Perf() {}
+
+bool Perf::available() { return false; }
+void Perf::start() {}
+Perf::Counters Perf::stop() { return Counters(); }
+
+#endif
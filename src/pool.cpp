@@ -0,0 +1,89 @@
+#include <CHIP-8/pool.h>
+#include <CHIP-8/trace.h>
+
+using namespace std;
+
+Pool::Pool (unsigned threads)
+{
+    for (unsigned i=0; i<threads; ++i)
+        workers.emplace_back(&Pool::work, this);
+}
+
+Pool::~Pool ()
+{
+    {
+        lock_guard<mutex> lock(jobs_mutex);
+        stopping = true;
+    }
+    jobs_ready.notify_all();
+
+    for (auto &worker : workers)
+        worker.join();
+}
+
+future<void> Pool::submit (function<void()> job)
+{
+    packaged_task<void()> task(move(job));
+    auto result = task.get_future();
+    {
+        lock_guard<mutex> lock(jobs_mutex);
+        jobs.push(move(task));
+    }
+    jobs_ready.notify_one();
+    return result;
+}
+
+void Pool::run (size_t count, const function<void(size_t)>& job)
+{
+    // Runs job(0) to job(count-1) on the workers and returns once all are
+    // done. Unlike submit, nothing is allocated, so it suits batches run
+    // over and over. The jobs must not throw.
+
+    if (count == 0)
+        return;
+
+    unique_lock<mutex> lock(jobs_mutex);
+    batch = &job;
+    batch_next = 0;
+    batch_size = count;
+    batch_left = count;
+    jobs_ready.notify_all();
+
+    batch_done.wait(lock, [this] { return batch_left == 0; });
+    batch = nullptr;
+}
+
+void Pool::work ()
+{
+    Trace::thread_name("Worker");
+
+    while (true) {
+        packaged_task<void()> task;
+        {
+            unique_lock<mutex> lock(jobs_mutex);
+            jobs_ready.wait(lock, [this] {
+                return stopping || !jobs.empty() || batch_next < batch_size;
+            });
+
+            // Batch jobs first, since their caller is waiting on them
+            if (batch_next < batch_size) {
+                size_t number = batch_next++;
+                auto job = batch;
+                lock.unlock();
+                (*job)(number);
+                lock.lock();
+                if (--batch_left == 0) {
+                    batch_size = 0;
+                    batch_done.notify_one();
+                }
+                continue;
+            }
+
+            if (jobs.empty())
+                return;
+            task = move(jobs.front());
+            jobs.pop();
+        }
+        task();
+    }
+}
@@ -0,0 +1,130 @@
+#include <CHIP-8/hash.h>
+#include <CHIP-8/mapping.h>
+#include <CHIP-8/rom.h>
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unordered_map>
+
+using namespace std;
+
+namespace {
+
+struct Stamp {
+    long long size;
+    long long modified;
+    const Rom* rom;
+};
+
+mutex roms_mutex;
+unordered_map<uint64_t, const Rom*> by_hash;
+map<string, Stamp>                  by_path; // Skips rereading unchanged files
+unordered_map<uint64_t, Rom::Info>  metadata;
+
+}
+
+Rom::Rom (vector<uint8_t> bytes, uint64_t digest):
+    bytes(move(bytes)),
+    digest(digest)
+{
+}
+
+const Rom& Rom::open (const string& path)
+{
+    // Throws runtime_error if the file cannot be read
+
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || (info.st_mode & S_IFMT) != S_IFREG)
+        throw runtime_error("No se pudo abrir el rom: " + path);
+
+    const long long size = info.st_size;
+    const long long modified = info.st_mtime;
+    {
+        lock_guard<mutex> lock(roms_mutex);
+        auto known = by_path.find(path);
+        if (known != by_path.end() && known->second.size == size
+                                   && known->second.modified == modified)
+            return *known->second.rom;
+    }
+
+    // The whole file in one copy out of a read-only mapping
+    vector<uint8_t> bytes;
+    if (size > 0) {
+        Mapping file(path);
+        if (!file.valid())
+            throw runtime_error("No se pudo leer el rom: " + path);
+        bytes.assign(file.data(), file.data() + file.size());
+    }
+    auto hash = hash64(bytes.data(), bytes.size());
+
+    lock_guard<mutex> lock(roms_mutex);
+    auto &rom = by_hash[hash];
+    if (!rom)
+        rom = new Rom(move(bytes), hash);
+    by_path[path] = {size, modified, rom};
+    return *rom;
+}
+
+const Rom* Rom::find (uint64_t hash)
+{
+    lock_guard<mutex> lock(roms_mutex);
+    auto found = by_hash.find(hash);
+    return found == by_hash.end() ? nullptr : found->second;
+}
+
+void Rom::read_metadata (const string& path)
+{
+    // Unreadable files and malformed lines are skipped
+
+    ifstream file(path);
+    string line;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        istringstream fields(line);
+        string hash, profile, flag;
+        if (!(fields >> hash >> profile))
+            continue;
+
+        Info info;
+        info.quirks = Quirks::profile(profile);
+        while (fields >> flag)
+            if (flag == "noidle")
+                info.idle_skip = false;
+
+        describe(strtoull(hash.c_str(), nullptr, 16), info);
+    }
+}
+
+void Rom::describe (uint64_t hash, const Info& info)
+{
+    lock_guard<mutex> lock(roms_mutex);
+    metadata[hash] = info;
+}
+
+const uint8_t* Rom::data () const
+{
+    return bytes.data();
+}
+
+size_t Rom::size () const
+{
+    return bytes.size();
+}
+
+uint64_t Rom::hash () const
+{
+    return digest;
+}
+
+const Rom::Info* Rom::info () const
+{
+    lock_guard<mutex> lock(roms_mutex);
+    auto found = metadata.find(digest);
+    return found == metadata.end() ? nullptr : &found->second;
+}
@@ -0,0 +1,142 @@
+#include <CHIP-8/trace.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct Event {
+    char        phase;    // 'X' complete, 'i' instant, 'M' thread name
+    const char* name;
+    long long   begin;    // Nanoseconds since Trace::start
+    long long   duration;
+    uint64_t    arg;
+    unsigned    tid;
+};
+
+mutex         events_mutex;
+vector<Event> events;
+vector<Event> names;      // Kept across start/stop
+atomic<unsigned> next_tid{0};
+
+unsigned tid()
+{
+    thread_local unsigned id = next_tid++;
+    return id;
+}
+
+void push(const Event& event)
+{
+    lock_guard<mutex> lock(events_mutex);
+    events.push_back(event);
+}
+
+}
+
+atomic<bool>      Trace::enabled{false};
+string            Trace::path = "trace.json";
+atomic<long long> Trace::origin{0};
+
+void Trace::start(string path)
+{
+    static bool registered = false;
+    if (!registered) {
+        // The emulator leaves through exit(), so flush from there too
+        atexit(Trace::stop);
+        registered = true;
+    }
+
+    Trace::path = path;
+    {
+        lock_guard<mutex> lock(events_mutex);
+        events.clear();
+    }
+    origin = chrono::duration_cast<chrono::nanoseconds>(
+                 clock::now().time_since_epoch()).count();
+    enabled = true;
+}
+
+void Trace::stop()
+{
+    if (!enabled)
+        return;
+    enabled = false;
+
+    lock_guard<mutex> lock(events_mutex);
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file)
+        return;
+
+    events.insert(events.begin(), names.begin(), names.end());
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (size_t i=0; i<events.size(); ++i)
+    {
+        auto &e = events[i];
+        const char* comma = i+1 < events.size() ? "," : "";
+
+        switch (e.phase) {
+            case 'X':
+                fprintf(file,
+                    "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"pid\":1,\"tid\":%u}%s\n",
+                    e.name, e.begin / 1e3, e.duration / 1e3, e.tid, comma);
+                break;
+            case 'i':
+                fprintf(file,
+                    "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,"
+                    "\"pid\":1,\"tid\":%u,\"args\":{\"frame\":%llu}}%s\n",
+                    e.name, e.begin / 1e3, e.tid,
+                    (unsigned long long) e.arg, comma);
+                break;
+            case 'M':
+                fprintf(file,
+                    "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                    "\"tid\":%u,\"args\":{\"name\":\"%s\"}}%s\n",
+                    e.tid, e.name, comma);
+                break;
+        }
+    }
+    fprintf(file, "]}\n");
+    fclose(file);
+    events.clear();
+}
+
+void Trace::toggle()
+{
+    if (enabled)
+        stop();
+    else
+        start(path);
+}
+
+void Trace::frame(uint64_t number)
+{
+    if (enabled)
+        push({'i', "frame", now(), 0, number, tid()});
+}
+
+void Trace::thread_name(const char* name)
+{
+    lock_guard<mutex> lock(events_mutex);
+    names.push_back({'M', name, 0, 0, 0, tid()});
+}
+
+long long Trace::now()
+{
+    // Read straight from the clock, as zones close on pool threads too
+    auto since_epoch = clock::now().time_since_epoch();
+    return chrono::duration_cast<chrono::nanoseconds>(since_epoch).count() - origin;
+}
+
+void Trace::complete(const char* name, long long begin)
+{
+    // Zones that straddle a stop() are dropped
+    if (enabled)
+        push({'X', name, begin, now() - begin, 0, tid()});
+}